@@ -115,6 +115,24 @@
 #define DIRTYON  0x00000400
 #define VALIDON  0x00000200
 #define GLOBALON 0x00000100
+#define ENTRYLO_PFN_MASK 0xFFFFF000
+
+/* Bit software dell'EntryLO (bit 7..0, ignorati dal TLB) usati dal
+ * Support Level nelle Page Table delle U-proc. */
+#define PTE_REFERENCED 0x00000001 /* pagina acceduta (TLB-Refill/Pager) */
+#define PTE_ZEROFILL   0x00000002 /* contenuto iniziale nullo, non letto  */
+#define PTE_SHARED     0x00000004 /* .text in sola lettura, condivisibile */
+#define PTE_COW        0x00000008 /* frame condiviso con il padre/figli (fork) */
+
+/* Page Table a due livelli delle U-proc: una directory (sup_pgDir) con una
+ * entry per ogni blocco di PGTBL_ENTRIES pagine di kuseg, che punta a una
+ * tabella di secondo livello grande un frame, allocata su richiesta. */
+#define PGTBL_SHIFT    9
+#define PGTBL_ENTRIES  (1 << PGTBL_SHIFT)
+#define PGDIR_ENTRIES  512        /* 2^18 pagine di kuseg / PGTBL_ENTRIES */
+
+/* Regioni di device a blocchi mappate contemporaneamente da una U-proc. */
+#define MMAP_MAX       4
 
 
 /* EntryHI register constants */
@@ -124,6 +142,11 @@
 #define ASIDSHIFT     6
 #define SHAREDSEGFLAG 30
 
+/* ASID di un EntryHI e suo bit nelle maschere di ASID del TLB (gli ASID
+ * in uso sono 0..UPROCMAX). */
+#define ENTRYHI_ASID(hi)  (((hi) >> ASIDSHIFT) & 0x3F)
+#define TLBASIDBIT(asid)  (1u << ((asid) & 0x1F))
+
 #define SENDMSG 1
 #define RECEIVEMSG 2
 
@@ -134,6 +157,31 @@
 
 /* Index register constants */
 #define PRESENTFLAG 0x80000000
+#define INDEXSHIFT  8          /* campo Index (bit 8..13), come in uMPS3 */
+
+/* Il layout del registro Index di µRISCV non è verificato sugli header
+ * della macchina: INDEXSHIFT è quello di uMPS3. Finché TLB_INDEX_KNOWN
+ * vale 0 il kernel non legge né scrive entry del TLB scelte per indice
+ * (setINDEX seguita da TLBWI o TLBR), e le entry riservate sono spente. */
+#ifndef TLB_INDEX_KNOWN
+#define TLB_INDEX_KNOWN 0
+#endif
+
+/* TLB: numero di entry (tlb-size nella configurazione della macchina) e
+ * entry riservate (wired) alla U-proc in esecuzione: la 0 per la pagina
+ * dello stack, la 1 per quella del codice corrente. Con TLB_WIRED_MODE
+ * il rimpiazzo avviene solo sulle entry TLB_WIRED..TLB_SIZE-1. Spente di
+ * default: dipendono dal layout di Index e il guadagno non è misurato. */
+#define TLB_SIZE    16
+#define TLB_WIRED   2
+#ifndef TLB_WIRED_MODE
+#define TLB_WIRED_MODE TLB_INDEX_KNOWN
+#endif
+
+/* EntryHI dell'entry del TLB invalidata nello slot idx: il VPN idx è
+ * fuori da kuseg e non viene mai tradotto, quindi l'entry non corrisponde
+ * ad alcun accesso. Un VPN diverso per ogni slot evita entry identiche. */
+#define TLB_NOMATCH_HI(idx)  ((idx) << VPNSHIFT)
 
 
 /* Device register constants */
@@ -29,13 +29,40 @@ typedef struct context_t
     unsigned int pc;
 } context_t;
 
+/* Regione di un device a blocchi mappata nello spazio di una U-proc */
+typedef struct mmap_t
+{
+    int mm_line;        /* IL_DISK o IL_FLASH */
+    int mm_dev;         /* numero del device */
+    int mm_block;       /* blocco della prima pagina */
+    int mm_first;       /* indice della prima pagina nella Page Table */
+    int mm_pages;       /* pagine mappate, 0 se la regione è libera */
+} mmap_t;
+
 /* Support level descriptor */
 typedef struct support_t
 {
     int sup_asid;                               /* process ID					*/
     state_t sup_exceptState[2];                 /* old state exceptions			*/
     context_t sup_exceptContext[2];             /* new contexts for passing up	*/
-    pteEntry_t sup_privatePgTbl[USERPGTBLSIZE]; /* user page table				*/
+    pteEntry_t **sup_pgDir;                     /* directory (PGDIR_ENTRIES), 2 livelli */
+    memaddr sup_brk;                            /* fine dello heap (SYS12) */
+    int sup_lastFault;                          /* ultima pagina caricata (read-ahead) */
+    int sup_raWindow;                           /* pagine da leggere in anticipo */
+    int sup_zeroFrom;                           /* prima pagina .bss, -1 se ignota */
+    int sup_imgDev;                             /* flash dell'immagine del programma */
+    int sup_parent;                             /* ASID del padre (fork), 0 se nessuno */
+    int sup_children;                           /* figli creati con fork ancora vivi */
+    int sup_childSem;                           /* V da ogni figlio che termina */
+    mmap_t sup_maps[MMAP_MAX];                  /* regioni di device mappate */
+    struct list_head sup_resident;              /* frame privati residenti (sw_link) */
+    int sup_rss;                                /* frame nella lista sup_resident */
+    int sup_quota;                              /* quota di frame (PFF), 0 se libera */
+    int sup_pffFaults;                          /* page fault nella finestra corrente */
+    cpu_t sup_pffStart;                         /* inizio della finestra (TOD) */
+    int sup_suspend;                            /* stato per il controllo del carico */
+    int sup_resumeSem;                          /* attesa della ripresa (sospesa) */
+    unsigned int sup_launchSeq;                 /* ordine di avvio: le più recenti prima */
     unsigned int sup_stackTLB[500];
     unsigned int sup_stackGen[500];
     struct list_head s_list;
@@ -47,6 +74,13 @@ typedef struct swap_t
     int sw_asid;        /* ASID number			*/
     int sw_pageNo;      /* page's virt page no.	*/
     pteEntry_t *sw_pte; /* page's PTE entry.	*/
+    int sw_prefetched;  /* ASID che l'ha letta in anticipo, 0 se nessuno */
+    int sw_busy;        /* I/O in corso sul frame (page-in/page-out) */
+    int sw_dev;         /* flash dell'immagine (.text condiviso), -1 altrimenti */
+    int sw_refs;        /* U-proc che mappano il frame (pagine condivise) */
+    int sw_owners;      /* ASID (bitmask) di un frame COW in uscita */
+    int sw_reclaim;     /* frame libero: ex proprietario della pagina rimasta, 0 se nessuno */
+    struct list_head sw_link; /* nella lista dei frame del proprietario */
 } swap_t;
 
 /* process table entry type */
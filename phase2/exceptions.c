@@ -18,6 +18,10 @@
 #define CAUSE_EXCCODE_MASK 0xFFu
 #endif
 
+#ifndef REFILL_PROFILE
+#define REFILL_PROFILE 0
+#endif
+
 #if DEBUG_EXC
 #define EDBG(msg)         debug_print(msg)
 #define EDBG_HEX(msg,val) debug_hex(msg,val)
@@ -39,6 +43,121 @@ static void copyState(state_t *dst, state_t *src);
 extern void scheduler(void);
 extern void interruptHandler(void);
 
+#ifdef SUPPORT_LEVEL
+/* Numero di eventi di TLB-Refill, osservabile dal Support Level. */
+unsigned int tlbRefills = 0;
+
+/* Entry riservate (wired) del TLB attive (modificabile al boot). */
+int tlbWiredMode = TLB_WIRED_MODE;
+
+/* Directory della Page Table della U-proc in esecuzione, NULL per un
+ * processo senza support structure: aggiornata a ogni dispatch
+ * (tlbDispatch), evita al refill di passare per currentProcess. */
+static pteEntry_t **refillPgDir = NULL;
+
+/* Cicli spesi nel refill, misurati con -DREFILL_PROFILE=1: rapportati a
+ * tlbRefills danno il costo medio di un refill in istruzioni. */
+unsigned int refillCycles = 0;
+
+/* ASID che possono avere entry nel TLB (un bit per ASID, TLBASIDBIT):
+ * acceso a ogni scrittura di un'entry, spento solo dalla pulizia completa
+ * del TLB per quell'ASID (tlbSweep nel Support Level). */
+unsigned int tlbAsidMask = 0;
+
+/* Prossima entry non riservata da rimpiazzare (round-robin). */
+static unsigned int tlbNext = TLB_WIRED;
+
+/* Scrive EntryHI/EntryLO (hi è il valore già caricato in EntryHI) in
+ * un'entry del TLB da rimpiazzare: con le entry riservate attive una tra
+ * TLB_WIRED..TLB_SIZE-1 a rotazione (TLBWI), altrimenti una qualsiasi
+ * scelta dall'hardware (TLBWR). */
+void tlbWriteFree(unsigned int hi) {
+    tlbAsidMask |= TLBASIDBIT(ENTRYHI_ASID(hi));
+    if (!tlbWiredMode) {
+        TLBWR();
+        return;
+    }
+    setINDEX(tlbNext << INDEXSHIFT);
+    TLBWI();
+    if (++tlbNext == TLB_SIZE)
+        tlbNext = TLB_WIRED;
+}
+
+/* Scrive nell'entry riservata slot la traduzione della pagina di addr
+ * della U-proc sup, se presente in memoria; un'eventuale copia della
+ * stessa traduzione in un'altra entry viene invalidata (niente entry
+ * doppie nel TLB). Se la pagina non è valida l'entry resta com'è: le
+ * invalidazioni del Pager cercano le entry con TLBP, quindi il suo
+ * contenuto non è mai obsoleto. */
+static void wireEntry(unsigned int slot, support_t *sup, memaddr addr) {
+    unsigned int rel = (addr >> VPNSHIFT) - (KUSEG >> VPNSHIFT);
+    pteEntry_t  *tbl = (rel < PGDIR_ENTRIES * PGTBL_ENTRIES)
+        ? sup->sup_pgDir[rel >> PGTBL_SHIFT]
+        : NULL;
+    if (tbl == NULL || !(tbl[rel & (PGTBL_ENTRIES - 1)].pte_entryLO & VALIDON))
+        return;
+
+    pteEntry_t *pte = &tbl[rel & (PGTBL_ENTRIES - 1)];
+    pte->pte_entryLO |= PTE_REFERENCED;
+
+    setENTRYHI(pte->pte_entryHI);
+    TLBP();
+    if (!(getINDEX() & PRESENTFLAG) && (getINDEX() >> INDEXSHIFT) != slot) {
+        setENTRYHI(TLB_NOMATCH_HI(getINDEX() >> INDEXSHIFT));
+        setENTRYLO(0);
+        TLBWI();
+        setENTRYHI(pte->pte_entryHI);
+    }
+    setENTRYLO(pte->pte_entryLO);
+    setINDEX(slot << INDEXSHIFT);
+    TLBWI();
+    tlbAsidMask |= TLBASIDBIT(ENTRYHI_ASID(pte->pte_entryHI));
+}
+
+/* Prepara il TLB al dispatch del processo p: directory della Page Table
+ * per il refill e, per una U-proc, le entry riservate con la pagina dello
+ * stack e quella dell'istruzione a cui riprende. Chiamata dallo scheduler
+ * prima di ogni LDST. */
+void tlbDispatch(pcb_t *p) {
+    refillPgDir = (p->p_supportStruct != NULL)
+        ? p->p_supportStruct->sup_pgDir
+        : NULL;
+    if (!tlbWiredMode || refillPgDir == NULL)
+        return;
+
+    unsigned int savedHI = getENTRYHI();
+    memaddr      sp      = p->p_s.reg_sp;
+    memaddr      pc      = p->p_s.pc_epc;
+
+    wireEntry(0, p->p_supportStruct, sp);
+    if ((pc >> VPNSHIFT) != (sp >> VPNSHIFT))
+        wireEntry(1, p->p_supportStruct, pc);
+    setENTRYHI(savedHI);
+}
+
+/* Percorso generale del refill: pagina fuori da kuseg, senza tabella o
+ * non valida. Installa un'entry non valida (o la PTE non valida): il fault
+ * che segue porta al Pager, che carica la pagina, crea la tabella o
+ * termina la U-proc. */
+static void refillSlow(state_t *savedState, unsigned int rel) {
+    pteEntry_t *tbl = (rel < PGDIR_ENTRIES * PGTBL_ENTRIES && refillPgDir != NULL)
+        ? refillPgDir[rel >> PGTBL_SHIFT]
+        : NULL;
+
+    if (tbl == NULL) {
+        setENTRYHI(savedState->entry_hi);
+        setENTRYLO(0);
+    } else {
+        pteEntry_t *pte = &tbl[rel & (PGTBL_ENTRIES - 1)];
+        pte->pte_entryLO |= PTE_REFERENCED;
+        setENTRYHI(pte->pte_entryHI);
+        setENTRYLO(pte->pte_entryLO);
+    }
+    tlbWriteFree(savedState->entry_hi);
+    LDST(savedState);
+}
+#endif
+
 /* ------------------------------------------------------------------ */
 /* TLB-Refill event handler                                            */
 /*                                                                     */
@@ -46,23 +165,50 @@ extern void interruptHandler(void);
 /* (primo frame di RAM). In phase 2 (nessuna support struct) si comporta*/
 /* come lo skeleton fornito dal tester; in phase 3 (SUPPORT_LEVEL) usa  */
 /* la Page Table della U-proc corrente per ricaricare l'entry mancante. */
+/*                                                                     */
+/* E' il gestore eseguito più spesso con la paginazione: è compilato   */
+/* con -O2 anche se il resto del kernel è a -O0, e tratta in linea solo*/
+/* il caso comune (PTE valida), lasciando il resto a refillSlow.       */
 /* ------------------------------------------------------------------ */
+void uTLB_RefillHandler(void) __attribute__((optimize("O2")));
 void uTLB_RefillHandler(void) {
     state_t *savedState = (state_t *) BIOSDATAPAGE;
 
 #ifdef SUPPORT_LEVEL
-    /* Indice [0..31] della pagina mancante nella Page Table. */
-    unsigned int vpn = (savedState->entry_hi >> VPNSHIFT) & 0xFFFFF;
-    int index;
-    if (vpn == 0xBFFFF)
-        index = 31;                       /* pagina di stack */
-    else
-        index = (int)(vpn - 0x80000);     /* pagine .text/.data 0..30 */
-
-    pteEntry_t *pte = &currentProcess->p_supportStruct->sup_privatePgTbl[index];
-    setENTRYHI(pte->pte_entryHI);
-    setENTRYLO(pte->pte_entryLO);
-    TLBWR();
+#if REFILL_PROFILE
+    cpu_t start = *((cpu_t *) TODLOADDR);
+#endif
+    /* Pagina mancante nella Page Table a due livelli: entry della
+     * directory e indice nella tabella di secondo livello, dal VPN relativo
+     * all'inizio di kuseg (un VPN sotto kuseg diventa enorme: fuori range,
+     * con un solo confronto). */
+    unsigned int hi  = savedState->entry_hi;
+    unsigned int rel = (hi >> VPNSHIFT) - (KUSEG >> VPNSHIFT);
+    pteEntry_t  *tbl;
+    pteEntry_t  *pte = NULL;
+
+    tlbRefills++;
+    if (rel < PGDIR_ENTRIES * PGTBL_ENTRIES && refillPgDir != NULL &&
+        (tbl = refillPgDir[rel >> PGTBL_SHIFT]) != NULL)
+        pte = &tbl[rel & (PGTBL_ENTRIES - 1)];
+    if (pte == NULL || !(pte->pte_entryLO & VALIDON)) {
+        refillSlow(savedState, rel); /* termina con LDST */
+        return;
+    }
+
+    unsigned int lo = pte->pte_entryLO;
+
+    /* Bit di riferimento per il rimpiazzo Clock del Pager: il Pager lo
+     * azzera e toglie l'entry dal TLB, così un nuovo accesso passa di qui.
+     * EntryHI è quello dell'accesso mancato (stesso VPN e ASID della PTE). */
+    if (!(lo & PTE_REFERENCED))
+        pte->pte_entryLO = lo |= PTE_REFERENCED;
+    setENTRYHI(hi);
+    setENTRYLO(lo);
+    tlbWriteFree(hi);
+#if REFILL_PROFILE
+    refillCycles += *((cpu_t *) TODLOADDR) - start;
+#endif
     LDST(savedState);
 #else
     /* phase 2: skeleton placeholder (il p5 del tester scrive a 0x80000000). */
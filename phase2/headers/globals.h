@@ -70,4 +70,9 @@ extern cpu_t startTOD;
 
 extern pcb_t *currentProcess;
 extern cpu_t startTOD;
+
+#ifdef SUPPORT_LEVEL
+/* Prepara il TLB al dispatch del processo p (exceptions.c). */
+extern void tlbDispatch(pcb_t *p);
+#endif
 #endif  
\ No newline at end of file
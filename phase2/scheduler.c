@@ -35,6 +35,9 @@ void scheduler(void) {
             currentProcess = y;
             STCK(startTOD);
             setTIMER(TIMESLICE * (*((cpu_t *) TIMESCALEADDR)));
+#ifdef SUPPORT_LEVEL
+            tlbDispatch(currentProcess);
+#endif
             LDST(&currentProcess->p_s);
         }
     }
@@ -44,6 +47,9 @@ void scheduler(void) {
         currentProcess = removeProcQ(&readyQueue);
         STCK(startTOD);
         setTIMER(TIMESLICE * (*((cpu_t *) TIMESCALEADDR)));
+#ifdef SUPPORT_LEVEL
+        tlbDispatch(currentProcess);
+#endif
         LDST(&currentProcess->p_s);
     }
 
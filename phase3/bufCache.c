@@ -0,0 +1,326 @@
+/*
+ * bufCache.c - Phase 3 / Level 4
+ *
+ * Cache dei blocchi dei device di memoria di massa (flash e disk):
+ *   - operazione fisica su un blocco (devBlockOp), con la traduzione
+ *     blocco lineare -> cilindro/testina/settore per il disk
+ *   - cache write-back indicizzata da (device, blocco), con rimpiazzo LRU
+ *   - flush esplicito dei blocchi modificati e contatori hit/miss
+ *
+ * I frame della cache stanno oltre lo Swap Pool (allocFrames), quindi non
+ * sottraggono memoria né al kernel né alle U-proc.
+ */
+
+#include "headers/support.h"
+
+/* Identificativo compatto di un device: coincide con l'indice del suo
+ * mutex in devMutex (disk 0..7, flash 8..15). */
+#define DEVID(line, dev)  (((line) - IL_DISK) * DEVPERINT + (dev))
+#define DEVID_LINE(id)    (IL_DISK + (id) / DEVPERINT)
+#define DEVID_DEV(id)     ((id) % DEVPERINT)
+
+/* Nessun device: marca un'entry libera o senza write-back in corso. */
+#define BC_NODEV (-1)
+
+/* Entry della cache: un frame e il blocco che contiene. */
+typedef struct bcache_t {
+    int              bc_dev;     /* DEVID del blocco, BC_NODEV se libera   */
+    int              bc_block;   /* numero di blocco sul device            */
+    int              bc_valid;   /* contenuto del frame significativo      */
+    int              bc_dirty;   /* modificato, non ancora sul device      */
+    int              bc_busy;    /* I/O in corso sul frame                 */
+    int              bc_wbDev;   /* blocco precedente in scrittura sul     */
+    int              bc_wbBlock; /* device durante il riuso dell'entry     */
+    memaddr          bc_frame;   /* frame fisico dei dati                  */
+    struct list_head bc_lru;     /* lista LRU: in testa il più recente     */
+} bcache_t;
+
+/* Cilindro su cui è posizionata la testina di ciascun disk: un SEEK verso
+ * il cilindro corrente è superfluo (accessi sequenziali). */
+#define CYL_UNKNOWN 0xFFFFFFFF
+static unsigned int diskCyl[DEVPERINT];
+
+static bcache_t         bcache[BCACHE_FRAMES];
+static struct list_head bcacheLru;
+static int              bcacheSem;
+
+unsigned int bcacheHits;
+unsigned int bcacheMisses;
+unsigned int bcacheWritebacks;
+
+/* Inizializzazione */
+void initBufCache(void) {
+    memaddr base = allocFrames(BCACHE_FRAMES);
+
+    bcacheSem = 1;
+    bcacheHits = bcacheMisses = bcacheWritebacks = 0;
+    INIT_LIST_HEAD(&bcacheLru);
+    for (int i = 0; i < DEVPERINT; i++)
+        diskCyl[i] = CYL_UNKNOWN;
+    for (int i = 0; i < BCACHE_FRAMES; i++) {
+        bcache[i].bc_dev   = BC_NODEV;
+        bcache[i].bc_wbDev = BC_NODEV;
+        bcache[i].bc_valid = bcache[i].bc_dirty = bcache[i].bc_busy = 0;
+        bcache[i].bc_frame = base + i * PAGESIZE;
+        list_add_tail(&bcache[i].bc_lru, &bcacheLru);
+    }
+}
+
+/* Operazione fisica sul device */
+
+/* Numero di blocchi del device (line, devNo), letto da data1: MAXBLOCK per
+ * il flash, la geometria (cilindri, testine, settori) per il disk. */
+unsigned int devBlockCount(int line, int devNo) {
+    dtpreg_t *dev = (dtpreg_t *) DEV_REG_ADDR(line, devNo);
+
+    if (line == IL_FLASH)
+        return dev->data1;
+    return (dev->data1 >> 16) * ((dev->data1 >> 8) & 0xFF) * (dev->data1 & 0xFF);
+}
+
+/* Legge (write = 0) o scrive (write = 1) il blocco blockNo del device
+ * (line, devNo) usando frame come sorgente/destinazione DMA. Per il disk
+ * il blocco lineare è tradotto in (cilindro, testina, settore) secondo la
+ * geometria in data1, con un SEEK preliminare solo se la testina non è
+ * già sul cilindro giusto. Ritorna lo status. */
+int devBlockOp(int line, int devNo, int blockNo, memaddr frame, int write) {
+    dtpreg_t    *dev   = (dtpreg_t *) DEV_REG_ADDR(line, devNo);
+    int          mutex = DEVID(line, devNo);
+    unsigned int status;
+
+    SYSCALL(PASSEREN, (int)&devMutex[mutex], 0, 0);
+
+    if (line == IL_FLASH) {
+        dev->data0 = frame;
+        /* numero blocco nei 3 byte alti, comando nel byte basso */
+        unsigned int command = ((unsigned int)blockNo << 8) |
+                               (write ? FLASHWRITE : FLASHREAD);
+        status = SYSCALL(DOIO, (int)&dev->command, (int)command, 0);
+    } else {
+        /* data1 = MAXCYL (16 bit alti), MAXHEAD (8 bit), MAXSECT (8 bit) */
+        unsigned int maxHead = (dev->data1 >> 8) & 0xFF;
+        unsigned int maxSect = dev->data1 & 0xFF;
+        unsigned int sect = (unsigned int)blockNo % maxSect;
+        unsigned int head = ((unsigned int)blockNo / maxSect) % maxHead;
+        unsigned int cyl  = (unsigned int)blockNo / (maxSect * maxHead);
+
+        status = READY;
+        if (diskCyl[devNo] != cyl) {
+            status = SYSCALL(DOIO, (int)&dev->command,
+                             (int)((cyl << 8) | SEEKTOCYL), 0);
+            diskCyl[devNo] = ((status & 0xFF) == READY) ? cyl : CYL_UNKNOWN;
+        }
+        if ((status & 0xFF) == READY) {
+            dev->data0 = frame;
+            unsigned int command = (head << 16) | (sect << 8) |
+                                   (write ? DISKWRITE : DISKREAD);
+            status = SYSCALL(DOIO, (int)&dev->command, (int)command, 0);
+        }
+    }
+
+    SYSCALL(VERHOGEN, (int)&devMutex[mutex], 0, 0);
+    return (int)(status & 0xFF);
+}
+
+/* Gestione delle entry (da chiamare con bcacheSem acquisito) */
+
+/* Entry che contiene (o sta caricando) il blocco, NULL se assente. */
+static bcache_t *lookup(int id, int blockNo) {
+    for (int i = 0; i < BCACHE_FRAMES; i++)
+        if (bcache[i].bc_dev == id && bcache[i].bc_block == blockNo)
+            return &bcache[i];
+    return NULL;
+}
+
+/* TRUE se il blocco sta ancora venendo scritto sul device da un'entry
+ * che nel frattempo è stata riassegnata a un altro blocco. */
+static int writebackPending(int id, int blockNo) {
+    for (int i = 0; i < BCACHE_FRAMES; i++)
+        if (bcache[i].bc_wbDev == id && bcache[i].bc_wbBlock == blockNo)
+            return 1;
+    return 0;
+}
+
+/* Acquisisce bcacheSem e ritorna l'entry del blocco, attendendo che
+ * l'eventuale I/O in corso su di essa (o sulla sua vecchia copia) finisca.
+ * L'attesa è una YIELD: l'I/O altrui si conclude in tempi brevi e non
+ * serve un semaforo per ogni entry. */
+static bcache_t *lockAndLookup(int id, int blockNo) {
+    bcache_t *b;
+    SYSCALL(PASSEREN, (int)&bcacheSem, 0, 0);
+    while (((b = lookup(id, blockNo)) != NULL && b->bc_busy) ||
+           writebackPending(id, blockNo)) {
+        SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+        SYSCALL(YIELD, 0, 0, 0);
+        SYSCALL(PASSEREN, (int)&bcacheSem, 0, 0);
+    }
+    return b;
+}
+
+/* Porta l'entry in testa alla lista LRU (usata più di recente). */
+static inline void touch(bcache_t *b) {
+    list_del(&b->bc_lru);
+    list_add(&b->bc_lru, &bcacheLru);
+}
+
+/* Riserva un'entry per il blocco (id, blockNo), scegliendo la meno
+ * usata di recente tra quelle non occupate da I/O. L'entry torna marcata
+ * busy; se conteneva un blocco modificato, questo viene scritto sul device
+ * (rilasciando bcacheSem durante l'I/O). Ritorna NULL se tutte le entry
+ * sono busy, o se la scrittura del blocco precedente è fallita: l'entry
+ * torna allora a quel blocco, valido e modificato, e il chiamante accede
+ * direttamente al device. */
+static bcache_t *claimEntry(int id, int blockNo) {
+    struct list_head *pos;
+    bcache_t *b = NULL;
+
+    for (pos = bcacheLru.prev; pos != &bcacheLru; pos = pos->prev) {
+        bcache_t *c = container_of(pos, bcache_t, bc_lru);
+        if (!c->bc_busy) {
+            b = c;
+            break;
+        }
+    }
+    if (b == NULL)
+        return NULL;
+
+    int wasDirty = b->bc_valid && b->bc_dirty;
+    if (wasDirty) {
+        b->bc_wbDev   = b->bc_dev;
+        b->bc_wbBlock = b->bc_block;
+    }
+    b->bc_dev   = id;
+    b->bc_block = blockNo;
+    b->bc_valid = 0;
+    b->bc_dirty = 0;
+    b->bc_busy  = 1;
+    touch(b);
+
+    if (wasDirty) {
+        SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+        int st = devBlockOp(DEVID_LINE(b->bc_wbDev), DEVID_DEV(b->bc_wbDev),
+                            b->bc_wbBlock, b->bc_frame, 1);
+        SYSCALL(PASSEREN, (int)&bcacheSem, 0, 0);
+        if (st != READY) {
+            b->bc_dev   = b->bc_wbDev;
+            b->bc_block = b->bc_wbBlock;
+            b->bc_valid = 1;
+            b->bc_dirty = 1;
+            b->bc_busy  = 0;
+            b->bc_wbDev = BC_NODEV;
+            return NULL;
+        }
+        bcacheWritebacks++;
+        b->bc_wbDev = BC_NODEV;
+    }
+    return b;
+}
+
+/* Interfaccia pubblica */
+
+/* Legge il blocco (line, devNo, blockNo) nel frame dst, servendolo dalla
+ * cache se presente. Ritorna lo status del device (READY se OK). */
+int bcacheRead(int line, int devNo, int blockNo, memaddr dst) {
+    int       id = DEVID(line, devNo);
+    bcache_t *b  = lockAndLookup(id, blockNo);
+
+    if (b != NULL && b->bc_valid) {
+        bcacheHits++;
+        touch(b);
+        copyPage(dst, b->bc_frame);
+        SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+        return READY;
+    }
+
+    bcacheMisses++;
+    b = claimEntry(id, blockNo);
+    SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+    if (b == NULL)
+        return devBlockOp(line, devNo, blockNo, dst, 0);
+
+    int st = devBlockOp(line, devNo, blockNo, b->bc_frame, 0);
+
+    SYSCALL(PASSEREN, (int)&bcacheSem, 0, 0);
+    if (st == READY) {
+        b->bc_valid = 1;
+        copyPage(dst, b->bc_frame);
+    } else {
+        b->bc_dev = BC_NODEV;
+    }
+    b->bc_busy = 0;
+    SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+    return st;
+}
+
+/* Scrive il frame src nel blocco (line, devNo, blockNo). La scrittura
+ * resta in cache (write-back): il device è aggiornato solo quando
+ * l'entry viene rimpiazzata o con bcacheFlush. */
+int bcacheWrite(int line, int devNo, int blockNo, memaddr src) {
+    int       id = DEVID(line, devNo);
+    bcache_t *b  = lockAndLookup(id, blockNo);
+
+    if (b == NULL) {
+        b = claimEntry(id, blockNo);
+        if (b == NULL) {
+            SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+            return devBlockOp(line, devNo, blockNo, src, 1);
+        }
+        b->bc_busy = 0;
+    }
+
+    copyPage(b->bc_frame, src);
+    b->bc_valid = 1;
+    b->bc_dirty = 1;
+    touch(b);
+    SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+    return READY;
+}
+
+/* Scrive sul device il blocco modificato dell'entry b, non busy
+ * (bcacheSem acquisito, rilasciato durante l'I/O). Ritorna lo status; in
+ * caso di errore il blocco resta modificato. */
+static int flushEntry(bcache_t *b) {
+    b->bc_busy = 1;
+    SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+    int st = devBlockOp(DEVID_LINE(b->bc_dev), DEVID_DEV(b->bc_dev),
+                        b->bc_block, b->bc_frame, 1);
+    SYSCALL(PASSEREN, (int)&bcacheSem, 0, 0);
+    if (st == READY) {
+        b->bc_dirty = 0;
+        bcacheWritebacks++;
+    }
+    b->bc_busy = 0;
+    return st;
+}
+
+/* Scrive sui device tutti i blocchi modificati presenti in cache. */
+void bcacheFlush(void) {
+    SYSCALL(PASSEREN, (int)&bcacheSem, 0, 0);
+    for (int i = 0; i < BCACHE_FRAMES; i++) {
+        bcache_t *b = &bcache[i];
+        if (b->bc_busy || !b->bc_valid || !b->bc_dirty)
+            continue;
+        flushEntry(b);
+    }
+    SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+}
+
+/* Scrive sul device (line, devNo) i blocchi blockNo..blockNo+count-1
+ * modificati presenti in cache, attendendo l'I/O già in corso su di essi:
+ * al ritorno il device contiene l'ultima versione dell'intervallo. Ritorna
+ * READY o lo status del primo errore. */
+int bcacheFlushRange(int line, int devNo, int blockNo, int count) {
+    int id = DEVID(line, devNo);
+    int st = READY;
+
+    for (int k = blockNo; k < blockNo + count; k++) {
+        bcache_t *b = lockAndLookup(id, k);
+        if (b != NULL && b->bc_valid && b->bc_dirty) {
+            int w = flushEntry(b);
+            if (st == READY)
+                st = w;
+        }
+        SYSCALL(VERHOGEN, (int)&bcacheSem, 0, 0);
+    }
+    return st;
+}
@@ -0,0 +1,330 @@
+/*
+ * compCache.c - Phase 3 / Level 4
+ *
+ * Cache compressa delle pagine sfrattate, davanti all'area di swap:
+ *   - un'arena di ZCACHE_FRAMES frame divisa in chunk da ZC_CHUNK byte,
+ *     dove le pagine private sfrattate sporche sono copiate compresse
+ *   - compressione RLE a word: un token per run di word uguali o per una
+ *     sequenza di word letterali; le pagine tutte nulle o riempite con la
+ *     stessa word non occupano chunk (solo il valore di riempimento)
+ *   - un page fault su una pagina presente nella cache è servito dalla RAM,
+ *     senza I/O sul disk
+ *
+ * Quando l'arena è piena le entry più vecchie sono spostate (decompresse)
+ * nel loro slot dell'area di swap finché la nuova pagina non trova posto;
+ * solo se nessuna può essere spostata, o la pagina non si comprime
+ * abbastanza, questa va direttamente nel suo slot. I frame dell'arena,
+ * della tabella delle entry e di spill stanno oltre lo Swap Pool
+ * (allocFrames), e sono presi solo se la cache è compilata
+ * (ZCACHE_ENABLED): altrimenti ogni pagina va nel suo slot.
+ */
+
+#include "headers/support.h"
+
+/* Word in una pagina e chunk dell'arena. */
+#define ZC_PAGEWORDS  (PAGESIZE / WORDLEN)
+#define ZC_CHUNKWORDS (ZC_CHUNK / WORDLEN)
+#define ZC_CHUNKS     (ZCACHE_FRAMES * PAGESIZE / ZC_CHUNK)
+
+/* Dimensione massima (in word) di una pagina compressa: oltre, tenerla in
+ * RAM non conviene e la pagina va direttamente nell'area di swap. */
+#define ZC_MAXWORDS   (ZC_PAGEWORDS * 3 / 4)
+
+/* Token della codifica: bit alto acceso per un run (seguito dalla word
+ * ripetuta), spento per una sequenza di letterali (seguiti dalle word);
+ * nei bit bassi il numero di word. Un run conviene da ZC_MINRUN word. */
+#define ZC_RUN        0x80000000
+#define ZC_COUNT(t)   ((int)((t) & ~ZC_RUN))
+#define ZC_MINRUN     3
+
+/* Valori di ze_chunk di un'entry senza chunk. */
+#define ZC_NONE       0xFFFF  /* pagina non presente nella cache          */
+#define ZC_FILLED     0xFFFE  /* pagina riempita con la word ze_fill      */
+
+/* Entry di una pagina (una per coppia ASID, indice p). */
+typedef struct zcent_t {
+    unsigned short ze_chunk;  /* primo chunk, ZC_NONE o ZC_FILLED         */
+    unsigned short ze_words;  /* lunghezza della pagina compressa         */
+    unsigned int   ze_fill;   /* word di riempimento (ZC_FILLED)          */
+    unsigned int   ze_seq;    /* ordine di ingresso (spill dal più vecchio) */
+} zcent_t;
+
+int zcacheEnabled = ZCACHE_ENABLED;
+
+static zcent_t     *zcIndex;                       /* UPROCMAX * UPROC_PAGES */
+static unsigned int *zcArena;
+static unsigned int zcUsed[(ZC_CHUNKS + 31) / 32]; /* bitmap dei chunk       */
+static int          zcSem;
+static unsigned int zcSeq;                         /* ultimo ze_seq assegnato */
+static memaddr      zcSpill;                       /* frame di spill         */
+
+/* Inizializzazione */
+void initCompCache(void) {
+    zcSem   = 1;
+    zcSeq   = 0;
+    zcIndex = NULL;
+#if ZCACHE_ENABLED
+    zcArena = (unsigned int *) allocFrames(ZCACHE_FRAMES);
+    zcIndex = (zcent_t *) allocFrames(ZCACHE_INDEX_FRAMES);
+    zcSpill = allocFrames(1);
+
+    for (int e = 0; e < UPROCMAX * UPROC_PAGES; e++)
+        zcIndex[e].ze_chunk = ZC_NONE;
+#endif
+    for (int w = 0; w < (ZC_CHUNKS + 31) / 32; w++)
+        zcUsed[w] = 0;
+    vmStats.vs_zcStores = vmStats.vs_zcZero = vmStats.vs_zcFilled = 0;
+    vmStats.vs_zcRejects = vmStats.vs_zcFull = vmStats.vs_zcSpills = 0;
+    vmStats.vs_zcHits = vmStats.vs_zcMisses = 0;
+    vmStats.vs_zcOrigWords = vmStats.vs_zcCompWords = 0;
+    vmStats.vs_zcChunks = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++)
+        vmStats.vs_zcLatHist[i] = 0;
+}
+
+/* Codifica */
+
+/* Numero di word uguali a src[i] a partire da i. */
+static int runLength(unsigned int *src, int i) {
+    int n = 1;
+    while (i + n < ZC_PAGEWORDS && src[i + n] == src[i])
+        n++;
+    return n;
+}
+
+/* Comprime la pagina src in dst, o ne calcola solo la lunghezza se dst è
+ * NULL. Ritorna il numero di word prodotte, -1 se supera ZC_MAXWORDS. */
+static int encode(unsigned int *src, unsigned int *dst) {
+    int out = 0;
+    int i   = 0;
+
+    while (i < ZC_PAGEWORDS && out <= ZC_MAXWORDS) {
+        int n = runLength(src, i);
+        if (n >= ZC_MINRUN) {
+            if (dst != NULL) {
+                dst[out]     = ZC_RUN | n;
+                dst[out + 1] = src[i];
+            }
+            out += 2;
+            i   += n;
+            continue;
+        }
+
+        int start = i;
+        while (i < ZC_PAGEWORDS && n < ZC_MINRUN) {
+            i += n;
+            if (i < ZC_PAGEWORDS)
+                n = runLength(src, i);
+        }
+        if (dst != NULL) {
+            dst[out] = i - start;
+            for (int k = start; k < i; k++)
+                dst[out + 1 + k - start] = src[k];
+        }
+        out += 1 + i - start;
+    }
+    return (out <= ZC_MAXWORDS) ? out : -1;
+}
+
+/* Decomprime nella pagina dst i words word di src. */
+static void decode(unsigned int *src, int words, unsigned int *dst) {
+    int i = 0;
+    for (int k = 0; k < words; ) {
+        unsigned int t = src[k];
+        int          n = ZC_COUNT(t);
+        if (t & ZC_RUN) {
+            for (int j = 0; j < n; j++)
+                dst[i++] = src[k + 1];
+            k += 2;
+        } else {
+            for (int j = 0; j < n; j++)
+                dst[i++] = src[k + 1 + j];
+            k += 1 + n;
+        }
+    }
+}
+
+/* Gestione dell'arena (da chiamare con zcSem acquisito) */
+
+static inline int chunkBusy(int c) {
+    return (zcUsed[c / 32] >> (c % 32)) & 1;
+}
+
+static void markChunks(int first, int n, int used) {
+    for (int c = first; c < first + n; c++) {
+        if (used)
+            zcUsed[c / 32] |= 1u << (c % 32);
+        else
+            zcUsed[c / 32] &= ~(1u << (c % 32));
+    }
+    vmStats.vs_zcChunks += used ? n : -n;
+}
+
+/* Primi n chunk consecutivi liberi (first fit), -1 se non ce ne sono. */
+static int allocChunks(int n) {
+    int run = 0;
+    for (int c = 0; c < ZC_CHUNKS; c++) {
+        run = chunkBusy(c) ? 0 : run + 1;
+        if (run == n) {
+            markChunks(c - n + 1, n, 1);
+            return c - n + 1;
+        }
+    }
+    return -1;
+}
+
+static inline zcent_t *entryOf(int asid, int p) {
+    return &zcIndex[(asid - 1) * UPROC_PAGES + p];
+}
+
+/* Rimuove dalla cache la pagina dell'entry, liberandone i chunk. */
+static void dropEntry(zcent_t *e) {
+    if (e->ze_chunk != ZC_NONE && e->ze_chunk != ZC_FILLED)
+        markChunks(e->ze_chunk, (e->ze_words + ZC_CHUNKWORDS - 1) / ZC_CHUNKWORDS, 0);
+    e->ze_chunk = ZC_NONE;
+}
+
+/* Spill sul disk (zcSem acquisito) */
+
+/* Indice dell'entry con chunk entrata per prima nella cache tra quelle
+ * che hanno uno slot nell'area di swap, -1 se non ce ne sono. Lo slot di
+ * una pagina nella cache è stato riservato al suo sfratto (reserveSlots)
+ * e non cambia finché l'entry esiste: leggerlo senza swapPoolSem è
+ * sicuro. */
+static int oldestEntry(void) {
+    int          best = -1;
+    unsigned int age  = 0;
+
+    for (int k = 0; k < UPROCMAX * UPROC_PAGES; k++) {
+        zcent_t *e = &zcIndex[k];
+        if (e->ze_chunk == ZC_NONE || e->ze_chunk == ZC_FILLED ||
+            swapSlot(k / UPROC_PAGES + 1, k % UPROC_PAGES) < 0)
+            continue;
+        if (best < 0 || zcSeq - e->ze_seq > age) {
+            best = k;
+            age  = zcSeq - e->ze_seq;
+        }
+    }
+    return best;
+}
+
+/* Sposta l'entry più vecchia nel suo slot dell'area di swap: la pagina è
+ * decompressa nel frame di spill e scritta (nella cache dei blocchi) prima
+ * di liberarne i chunk, così un page fault concorrente, in attesa di
+ * zcSem, la trova poi nello slot. L'arena è bloccata durante la
+ * scrittura. Ritorna FALSE se nessuna entry è stata spostata. */
+static int spillOldest(void) {
+    int k = oldestEntry();
+    if (k < 0)
+        return 0;
+
+    zcent_t *e    = &zcIndex[k];
+    int      slot = swapSlot(k / UPROC_PAGES + 1, k % UPROC_PAGES);
+    decode(zcArena + e->ze_chunk * ZC_CHUNKWORDS, e->ze_words,
+           (unsigned int *) zcSpill);
+    if (bcacheWrite(IL_DISK, VMDISK, slot, zcSpill) != READY)
+        return 0;
+    dropEntry(e);
+    vmStats.vs_zcSpills++;
+    return 1;
+}
+
+/* Interfaccia per il Pager */
+
+/* Copia compressa nella cache la pagina p della U-proc asid, contenuta nel
+ * frame busy frame, al posto di quella eventualmente già presente. Con
+ * l'arena piena le entry più vecchie sono spostate sul disk per fare
+ * posto. Ritorna FALSE se la pagina va scritta nell'area di swap: cache
+ * disabilitata, pagina incomprimibile o arena piena senza entry che
+ * possano essere spostate. */
+int zcacheStore(int asid, int p, memaddr frame) {
+    unsigned int *src = (unsigned int *) frame;
+    int           ok  = 1;
+
+    if (zcIndex == NULL)
+        return 0;
+    SYSCALL(PASSEREN, (int)&zcSem, 0, 0);
+    zcent_t *e = entryOf(asid, p);
+    dropEntry(e);
+
+    if (!zcacheEnabled) {
+        ok = 0;
+    } else if (runLength(src, 0) == ZC_PAGEWORDS) {
+        e->ze_chunk = ZC_FILLED;
+        e->ze_fill  = src[0];
+        if (src[0] == 0)
+            vmStats.vs_zcZero++;
+        else
+            vmStats.vs_zcFilled++;
+    } else {
+        int words = encode(src, NULL);
+        int first = -1;
+        if (words < 0) {
+            vmStats.vs_zcRejects++;
+        } else {
+            int n = (words + ZC_CHUNKWORDS - 1) / ZC_CHUNKWORDS;
+            while ((first = allocChunks(n)) < 0 && spillOldest())
+                ;
+            if (first < 0)
+                vmStats.vs_zcFull++;
+        }
+        if (first < 0) {
+            ok = 0;
+        } else {
+            encode(src, zcArena + first * ZC_CHUNKWORDS);
+            e->ze_chunk = first;
+            e->ze_words = words;
+            e->ze_seq   = ++zcSeq;
+            vmStats.vs_zcStores++;
+            vmStats.vs_zcOrigWords += ZC_PAGEWORDS;
+            vmStats.vs_zcCompWords += words;
+        }
+    }
+    SYSCALL(VERHOGEN, (int)&zcSem, 0, 0);
+    return ok;
+}
+
+/* Se la pagina p della U-proc asid è nella cache la decomprime nel frame
+ * e ritorna TRUE; la copia resta nella cache (la pagina caricata è pulita
+ * e coincide con essa). */
+int zcacheLoad(int asid, int p, memaddr frame) {
+    if (zcIndex == NULL)
+        return 0;
+    SYSCALL(PASSEREN, (int)&zcSem, 0, 0);
+    zcent_t *e  = entryOf(asid, p);
+    int      ok = e->ze_chunk != ZC_NONE;
+
+    if (e->ze_chunk == ZC_FILLED) {
+        for (int i = 0; i < ZC_PAGEWORDS; i++)
+            ((unsigned int *) frame)[i] = e->ze_fill;
+    } else if (ok) {
+        decode(zcArena + e->ze_chunk * ZC_CHUNKWORDS, e->ze_words,
+               (unsigned int *) frame);
+    }
+    if (ok)
+        vmStats.vs_zcHits++;
+    else
+        vmStats.vs_zcMisses++;
+    SYSCALL(VERHOGEN, (int)&zcSem, 0, 0);
+    return ok;
+}
+
+/* TRUE se la pagina p della U-proc asid è nella cache. */
+int zcacheHas(int asid, int p) {
+    if (zcIndex == NULL)
+        return 0;
+    SYSCALL(PASSEREN, (int)&zcSem, 0, 0);
+    int ok = entryOf(asid, p)->ze_chunk != ZC_NONE;
+    SYSCALL(VERHOGEN, (int)&zcSem, 0, 0);
+    return ok;
+}
+
+/* Rimuove dalla cache tutte le pagine della U-proc asid (terminazione). */
+void zcacheFreeAsid(int asid) {
+    if (zcIndex == NULL)
+        return;
+    SYSCALL(PASSEREN, (int)&zcSem, 0, 0);
+    for (int p = 0; p < UPROC_PAGES; p++)
+        dropEntry(entryOf(asid, p));
+    SYSCALL(VERHOGEN, (int)&zcSem, 0, 0);
+}
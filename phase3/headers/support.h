@@ -18,21 +18,187 @@
 
 /* Costanti del Support Level*/
 
-/* Inizio dello Swap Pool: subito dopo i primi 32 frame riservati al SO
- * (0x20000000 + 32 * 4096 = 0x20020000). */
-#define SWAP_POOL_START (RAMSTART + (OSFRAMES * PAGESIZE))
+/* Inizio dello Swap Pool: il primo frame dopo l'immagine del kernel
+ * (.text, .data e .bss), la cui fine è il simbolo _end del linker script.
+ * Un numero fisso di frame per il SO (OSFRAMES) verrebbe superato in
+ * silenzio dalla crescita della memoria statica. */
+extern char _end[];
+#define SWAP_POOL_START ((((memaddr)_end) + PAGESIZE - 1) & ~(PAGESIZE - 1))
 
-/* Numero di frame nello Swap Pool: 2 * UPROCMAX (POOLSIZE = 16). */
-#define SWAP_POOL_SIZE  POOLSIZE
+/* Numero di frame nello Swap Pool: calcolato al boot dalla RAM
+ * disponibile (swapPoolSize), almeno 2 * UPROCMAX (POOLSIZE = 16) e al
+ * più quante pagine possono avere tutte le U-proc insieme. */
+#define SWAP_POOL_MIN   POOLSIZE
+#define SWAP_POOL_MAX   (UPROCMAX * UPROC_PAGES)
 
-/* Indirizzamento logico kuseg di una U-proc. */
+/* Politiche di rimpiazzo delle pagine dello Swap Pool. Quella di default
+ * si sceglie a compile-time (es. -DREPLACEMENT_POLICY=REPL_CLOCK) e resta
+ * modificabile al boot tramite la variabile replacementPolicy. FIFO, la
+ * politica originale, finché il guadagno del Clock non è misurato. */
+#define REPL_FIFO   0
+#define REPL_CLOCK  1
+#ifndef REPLACEMENT_POLICY
+#define REPLACEMENT_POLICY REPL_FIFO
+#endif
+
+/* Prefault al lancio di una U-proc (vedi prefaultUproc): spento di
+ * default finché il guadagno non è misurato, attivabile a compile-time o
+ * al boot (prefaultOnLaunch). */
+#ifndef PREFAULT_ON_LAUNCH
+#define PREFAULT_ON_LAUNCH 0
+#endif
+
+/* Quote di frame per U-proc adattate alla frequenza dei page fault (vedi
+ * quotaVictim): quota minima, ampiezza della finestra di conteggio, fault
+ * per finestra sopra cui la quota cresce e sotto cui cala, passo. Spente
+ * di default finché il guadagno non è misurato, attivabili a compile-time
+ * o al boot (wsQuotas). */
+#define WS_QUOTA_MIN   4
+#define PFF_WINDOW_US  100000
+#define PFF_HIGH       8
+#define PFF_LOW        2
+#define PFF_STEP       4
+#ifndef WS_QUOTAS
+#define WS_QUOTAS 0
+#endif
+
+/* Controllo del carico (vedi loadDecide): page fault del sistema per tick
+ * dello pseudo-clock (100 ms) e richieste in coda su disk e flash oltre
+ * cui una U-proc viene sospesa, fault per tick sotto cui una sospesa
+ * riprende. Spento di default finché il guadagno non è misurato,
+ * attivabile a compile-time o al boot (loadControl). Stati di
+ * sup_suspend. */
+#define LC_FAULTS_HIGH  40
+#define LC_FAULTS_LOW   8
+#define LC_IOQ_HIGH     4
+#ifndef LOAD_CONTROL
+#define LOAD_CONTROL 0
+#endif
+#define LC_RUNNING      0
+#define LC_SUSPEND_REQ  1   /* si sospende al prossimo page fault */
+#define LC_SUSPENDED    2   /* frame liberati, in attesa su sup_resumeSem */
+
+/* Read-ahead del Pager: numero di pagine lette in anticipo dopo un fault
+ * sequenziale (finestra iniziale, minima e massima per ASID). Spento di
+ * default finché il guadagno non è misurato, attivabile a compile-time o
+ * al boot (readAheadOn). */
+#define RA_INIT  2
+#define RA_MIN   1
+#define RA_MAX   8
+#ifndef READ_AHEAD
+#define READ_AHEAD 0
+#endif
+
+/* Daemon di page-out: soglie (di default) di frame liberi nello Swap Pool
+ * sotto cui viene risvegliato e fino a cui sfratta pagine. */
+#define PAGEOUT_LOW   2
+#define PAGEOUT_HIGH  4
+
+/* Istogramma delle latenze dei page fault: LAT_BUCKETS bucket, il primo
+ * fino a LAT_BASE_US microsecondi, ciascuno il doppio del precedente. */
+#define LAT_BUCKETS  12
+#define LAT_BASE_US  64
+
+/* Frame in cima alla RAM riservati al Nucleus (vedi initial.c): stack del
+ * TLB-Refill, stack dell'exception handler e stack del processo test. */
+#define KERNEL_TOP_FRAMES 3
+
+/* Cache dei blocchi (flash e disk): numero di frame dedicati. */
+#define BCACHE_FRAMES    32
+
+/* Cache compressa delle pagine sfrattate (compCache.c): frame dell'arena,
+ * dimensione di un chunk in byte e frame della tabella delle entry (12
+ * byte per ogni pagina di ogni U-proc). Un frame in più serve a
+ * decomprimere le pagine spostate sul disk quando l'arena è piena. La
+ * cache è spenta di default, finché il guadagno non è misurato: si
+ * compila con -DZCACHE_ENABLED=1, e la variabile zcacheEnabled la spegne
+ * al boot. Compilata spenta, i suoi frame restano allo Swap Pool. */
+#define ZCACHE_FRAMES        32
+#define ZC_CHUNK             128
+#define ZCACHE_INDEX_FRAMES  ((UPROCMAX * UPROC_PAGES * 12 + PAGESIZE - 1) / PAGESIZE)
+#ifndef ZCACHE_ENABLED
+#define ZCACHE_ENABLED 0
+#endif
+#if ZCACHE_ENABLED
+#define ZCACHE_RESERVED  (ZCACHE_FRAMES + 1 + ZCACHE_INDEX_FRAMES)
+#else
+#define ZCACHE_RESERVED  0
+#endif
+
+/* Frame per le tabelle di secondo livello delle Page Table: con il layout
+ * di kuseg qui sotto a ogni U-proc ne bastano due (immagine + heap +
+ * regioni mappate, esattamente PGTBL_ENTRIES pagine, e stack). */
+#define PGTBL_FRAMES     (2 * UPROCMAX)
+/* Frame per le directory (sup_pgDir) di tutte le U-proc. */
+#define PGDIR_FRAMES     ((UPROCMAX * PGDIR_ENTRIES * WORDLEN + PAGESIZE - 1) / PAGESIZE)
+
+/* Frame che le altre strutture del Support Level chiedono ad allocFrames
+ * dopo lo Swap Pool (cache dei blocchi, frame di I/O a blocchi per ASID,
+ * stack dei daemon delle stampanti, del page-out e del controllo del
+ * carico, frame di copia della fork, directory e tabelle delle Page
+ * Table, cache compressa con il suo frame di spill, mappa dell'area di
+ * swap): vanno esclusi dal
+ * dimensionamento dello Swap Pool. Chi aggiunge un allocFrames lo conta
+ * qui, altrimenti checkReservedFrames va in PANIC al boot. */
+#define SUPPORT_RESERVED_FRAMES (BCACHE_FRAMES + UPROCMAX + DEVPERINT + 3 + \
+                                 PGTBL_FRAMES + ZCACHE_RESERVED + \
+                                 SWAP_MAP_FRAMES + PGDIR_FRAMES)
+
+/* Indirizzamento logico kuseg di una U-proc: l'immagine del programma
+ * (.text/.data/.bss) da 0x80000000, lo heap subito dopo (esteso con la
+ * SYS12), lo stack che cresce verso il basso da USERSTACKTOP. Le pagine
+ * sono numerate in quest'ordine (indice p: immagine, heap, stack dalla
+ * cima) e p è anche il blocco della pagina sul backing store. Dopo lo heap
+ * c'è la finestra delle regioni di device mappate (SYS13/SYS14), con
+ * indici da UPROC_MMAPBASE: le sue pagine stanno sul device mappato, non
+ * sul backing store. */
 #define KUSEG_VPN_START   0x80000   /* VPN della prima pagina (0x80000000) */
-#define KUSEG_STACK_VPN   0xBFFFF   /* VPN della pagina di stack            */
-#define UPROC_STACKPAGE   31        /* indice della pagina di stack in PgTbl */
-#define UPROC_TEXTPAGES   31        /* pagine 0..30 per .text/.data          */
+#define KUSEG_STACK_VPN   0xBFFFF   /* VPN della pagina in cima allo stack  */
+#define UPROC_IMGPAGES    128       /* immagine: 512 KB                     */
+#define UPROC_HEAPPAGES   128       /* heap: 512 KB                         */
+#define UPROC_STACKPAGES  32        /* stack: 128 KB                        */
+#define UPROC_HEAPBASE    UPROC_IMGPAGES                     /* prima pagina di heap */
+#define UPROC_STACKBASE   (UPROC_HEAPBASE + UPROC_HEAPPAGES) /* cima dello stack     */
+#define UPROC_PAGES       (UPROC_STACKBASE + UPROC_STACKPAGES)
+#define HEAP_START        (KUSEG + UPROC_HEAPBASE * PAGESIZE)
+#define HEAP_END          (HEAP_START + UPROC_HEAPPAGES * PAGESIZE)
+#define UPROC_MMAPPAGES   256       /* regioni mappate: 1 MB                */
+#define UPROC_MMAPBASE    UPROC_PAGES
+#define MMAP_START        HEAP_END
+#define MMAP_END          (MMAP_START + UPROC_MMAPPAGES * PAGESIZE)
 
 /* Frame "vuoto" nella Swap Pool table (ASID non valido). */
 #define SWAP_FRAME_FREE  (-1)
+/* Valore di sw_asid di un frame con una pagina di .text condivisa. */
+#define SWAP_FRAME_SHARED (-2)
+/* Valore di sw_asid di un frame privato condiviso copy-on-write tra una
+ * U-proc e i figli creati con fork. */
+#define SWAP_FRAME_COW    (-3)
+/* Fault minori: i frame sfrattati restano recuperabili finché non sono
+ * riassegnati (disattivabile con -DFRAME_RECLAIM=0 o al boot tramite la
+ * variabile frameReclaim). */
+#ifndef FRAME_RECLAIM
+#define FRAME_RECLAIM 1
+#endif
+/* Bit di un ASID nelle maschere di U-proc (es. sw_owners). */
+#define ASIDBIT(asid)     (1 << ((asid) - 1))
+
+/* Immagine del programma sul flash della U-proc: letta dal Pager e mai
+ * scritta, quindi i blocchi di flash sotto BACKING_BLOCKS non sono
+ * scrivibili con la SYS9. */
+#define BACKING_BLOCKS    UPROC_IMGPAGES
+
+/* Area di swap (swapArea.c): i primi SWAP_SLOTS blocchi del disk VMDISK,
+ * riservati alle pagine private sfrattate sporche e non accessibili con
+ * SYS7/SYS8. Gli slot sono assegnati a cluster di SWAP_CLUSTER blocchi
+ * consecutivi per ASID: un cilindro con la geometria del disk creato da
+ * testers/Makefile (2 testine, 16 settori). */
+#define SWAP_SLOTS        2048
+#define SWAP_CLUSTER      32
+/* Frame della mappa pagina -> slot di tutte le U-proc (allocFrames). */
+#define SWAP_MAP_FRAMES   ((UPROCMAX * UPROC_PAGES * WORDLEN + PAGESIZE - 1) / PAGESIZE)
+/* Status di pageWrite quando l'area di swap è piena (nessuno slot). */
+#define SWAP_FULL         0xFF
 
 /* Stato processore per le U-proc: user-mode, interrupt e PLT abilitati. */
 #define UPROC_STATUS  (MSTATUS_MPIE_MASK | MSTATUS_MPP_U)
@@ -49,16 +215,42 @@
 #define SUP_WRITETERMINAL  4
 #define SUP_READTERMINAL   5
 #define SUP_EXECUTE        6
+#define SUP_DISKPUT        7
+#define SUP_DISKGET        8
+#define SUP_FLASHPUT       9
+#define SUP_FLASHGET       10
+#define SUP_FORK           11
+#define SUP_SBRK           12
+#define SUP_DISKMAP        13
+#define SUP_FLASHMAP       14
+#define SUP_UNMAP          15
+
+/* Secondo argomento delle syscall a blocchi (SYS7..SYS10): numero del
+ * device nel byte basso, numero di blocchi consecutivi nei bit alti. */
+#define BLKARG_DEV(a)      ((int)((a) & 0xFF))
+#define BLKARG_COUNT(a)    ((int)((a) >> 8))
 
-/* Lunghezza massima di una stringa scrivibile su terminale (SYS4). */
+/* Lunghezza massima di una stringa scrivibile su terminale o stampante
+ * (SYS3/SYS4). */
 #define MAXSTRLEN 128
 
+/* Spool delle stampanti: capienza del buffer circolare e numero massimo
+ * di caratteri prelevati dal daemon a ogni giro. */
+#define SPOOL_SIZE   1024
+#define SPOOL_BATCH  64
+
+/* Installed Devices Bit Map del bus (IDEV_BITMAP_ADDR di arch.h): bit i
+ * acceso se il device i della linea è presente. */
+#define DEV_INSTALLED(line, dev) \
+    ((*((unsigned int *)IDEV_BITMAP_ADDR(line)) >> (dev)) & 1)
+
 /* Semafori di mutua esclusione sui device (uno per sotto-device)      */
 /* Layout: [0..39] i 5*8 device "principali", [40..47] il secondo      */
 /* sotto-device dei terminali (ricezione).                             */
 #define DEVCNT            (DEVINTNUM * DEVPERINT)        /* 40 */
 #define DEV_MUTEX_TOTAL   (DEVCNT + DEVPERINT)           /* 48 */
 
+#define DISK_MUTEX(dev)     (((IL_DISK - IL_DISK) * DEVPERINT) + (dev))
 #define FLASH_MUTEX(dev)    (((IL_FLASH - IL_DISK) * DEVPERINT) + (dev))
 #define PRINTER_MUTEX(dev)  (((IL_PRINTER - IL_DISK) * DEVPERINT) + (dev))
 #define TERMW_MUTEX(dev)    (((IL_TERMINAL - IL_DISK) * DEVPERINT) + (dev))
@@ -66,10 +258,93 @@
 
 /* Variabili globali del Support Level                                 */
 
+/* Contatori della memoria virtuale (osservabili dal debugger). */
+typedef struct vmstats_t {
+    unsigned int vs_faults;     /* page fault maggiori (letti o azzerati) */
+    unsigned int vs_minorFaults;     /* ... minori (frame rimappato)     */
+    unsigned int vs_evictions;  /* frame sottratti a una pagina residente */
+    unsigned int vs_pageOuts;   /* pagine vittima scritte sul backing store */
+    unsigned int vs_refCleared; /* seconde chance concesse dal Clock     */
+    unsigned int vs_cleanEvictions; /* vittime pulite: scrittura evitata */
+    unsigned int vs_dirtied;    /* pagine marcate sporche (TLB-Mod)      */
+    unsigned int vs_readAhead;  /* pagine lette in anticipo              */
+    unsigned int vs_raHits;     /* ... e poi effettivamente riferite     */
+    unsigned int vs_raWasted;   /* ... e sfrattate senza essere usate    */
+    unsigned int vs_syncEvictions;   /* sfratti nel percorso del fault   */
+    unsigned int vs_daemonEvictions; /* sfratti anticipati dal daemon    */
+    unsigned int vs_maxInFlight;     /* max frame con I/O in corso       */
+    unsigned int vs_tlbInvals;       /* entry del TLB invalidate         */
+    unsigned int vs_tlbSweeps;       /* pulizie del TLB per un ASID      */
+    unsigned int vs_tlbBatched;      /* ... che sostituiscono una TLBP   */
+    unsigned int vs_tlbSkipped;      /* TLBP evitate (ASID non nel TLB)  */
+    unsigned int vs_pageIns;         /* pagine lette dal backing store   */
+    unsigned int vs_zeroFills;       /* pagine azzerate senza I/O        */
+    unsigned int vs_sharedHits;      /* .text trovato già in memoria     */
+    unsigned int vs_forks;           /* U-proc create con fork           */
+    unsigned int vs_cowCopies;       /* pagine COW copiate alla scrittura */
+    unsigned int vs_cowReuses;       /* ... rese private senza copia     */
+    unsigned int vs_launches;        /* U-proc lanciate (SYS6 e test)    */
+    unsigned int vs_prefaults;       /* pagine caricate al lancio        */
+    unsigned int vs_quotaGrows;      /* quote aumentate (fault frequenti) */
+    unsigned int vs_quotaShrinks;    /* quote ridotte (fault rari)       */
+    unsigned int vs_quotaEvictions;  /* vittime di U-proc oltre la quota */
+    unsigned int vs_suspends;        /* sospensioni decise (carico alto) */
+    unsigned int vs_suspended;       /* ... avvenute (frame liberati)    */
+    unsigned int vs_resumes;         /* riprese decise                   */
+    unsigned int vs_uprocTime;       /* CPU U-proc finite, us (STCK)     */
+    unsigned int vs_swapSlots;       /* slot dell'area di swap in uso    */
+    unsigned int vs_swapPeak;        /* ... massimo raggiunto            */
+    unsigned int vs_latHist[LAT_BUCKETS]; /* latenze dei page fault      */
+    unsigned int vs_zcStores;        /* pagine compresse nella cache     */
+    unsigned int vs_zcZero;          /* ... tutte nulle (senza chunk)    */
+    unsigned int vs_zcFilled;        /* ... riempite con una word        */
+    unsigned int vs_zcRejects;       /* incomprimibili: all'area di swap */
+    unsigned int vs_zcFull;          /* arena piena: all'area di swap    */
+    unsigned int vs_zcSpills;        /* entry vecchie spostate sul disk  */
+    unsigned int vs_zcHits;          /* letture servite dalla cache      */
+    unsigned int vs_zcMisses;        /* ... e non trovate                */
+    unsigned int vs_zcOrigWords;     /* word delle pagine compresse ...  */
+    unsigned int vs_zcCompWords;     /* ... e dopo la compressione       */
+    unsigned int vs_zcChunks;        /* chunk dell'arena in uso          */
+    unsigned int vs_zcLatHist[LAT_BUCKETS]; /* fault serviti dalla cache */
+} vmstats_t;
+
+extern vmstats_t vmStats;
+/* Eventi di TLB-Refill (contati in phase2/exceptions.c): rapportati a
+ * vmStats.vs_faults danno i refill per page fault, a vs_uprocTime per
+ * la frequenza del clock (istruzioni) i refill per istruzione. */
+extern unsigned int tlbRefills;
+/* Cicli spesi nel TLB-Refill (solo con -DREFILL_PROFILE=1). */
+extern unsigned int refillCycles;
+/* Entry riservate del TLB attive (modificabile al boot) e scrittura di
+ * un'entry non riservata (phase2/exceptions.c). */
+extern int tlbWiredMode;
+extern void tlbWriteFree(unsigned int hi);
+/* ASID che possono avere entry nel TLB (phase2/exceptions.c). */
+extern unsigned int tlbAsidMask;
+/* Politica di rimpiazzo in uso (REPL_FIFO / REPL_CLOCK). */
+extern int replacementPolicy;
+/* Read-ahead sequenziale del Pager attivo (modificabile al boot). */
+extern int readAheadOn;
+/* Prefault delle pagine di avvio al lancio (modificabile al boot). */
+extern int prefaultOnLaunch;
+/* Quote di frame per U-proc attive (modificabile al boot). */
+extern int wsQuotas;
+/* Controllo del carico attivo (modificabile al boot). */
+extern int loadControl;
+/* Frame sfrattati recuperabili con un fault minore (modificabile al boot). */
+extern int frameReclaim;
+/* Cache compressa attiva (modificabile al boot). */
+extern int zcacheEnabled;
+/* Soglie del daemon di page-out (modificabili al boot). */
+extern int pageoutLow;
+extern int pageoutHigh;
+
 /* Semaforo di mutua esclusione sullo Swap Pool (init 1). */
 extern int swapPoolSem;
-/* Swap Pool table: una entry per frame. */
-extern swap_t swapPool[SWAP_POOL_SIZE];
+/* Swap Pool table: una entry per frame, allocata al boot. */
+extern swap_t *swapPool;
+extern int     swapPoolSize;    /* frame nello Swap Pool */
 
 /* Semaforo per la conclusione "graziosa" dell'InstantiatorProcess. */
 extern int masterSemaphore;
@@ -82,20 +357,69 @@ extern int devMutex[DEV_MUTEX_TOTAL];
 /* Pool delle support structure (una per U-proc, indicizzata da ASID-1). */
 extern support_t supportPool[UPROCMAX];
 
+/* Contatori della cache dei blocchi (osservabili dal debugger). */
+extern unsigned int bcacheHits;
+extern unsigned int bcacheMisses;
+extern unsigned int bcacheWritebacks;
+
 /* Prototipi                                                           */
 
 /* initProc.c */
 extern void test(void);                 /* InstantiatorProcess */
 extern void launchUproc(int asid);      /* inizializza e avvia una U-proc */
+extern void initExceptContexts(support_t *sup);
+extern int  claimAsid(int asid);        /* riserva un ASID (0: uno libero) */
+extern int  asidActive(int asid);
+extern void freeAsid(int asid);
 extern support_t *getSupport(int asid);
 
 /* vmSupport.c */
 extern void initSwapStructs(void);      /* inizializza Swap Pool + semaforo */
 extern void pager(void);                /* TLB exception handler (Pager) */
+extern void initPageoutDaemon(void);    /* riserva di frame liberi */
+extern void initLoadControl(void);      /* sospensione contro il thrashing */
 extern void initUprocPageTable(support_t *sup);
-extern int  flashOperation(int asid, int blockNo, memaddr frameAddr, int op);
+extern void prefaultUproc(support_t *sup); /* pagine di avvio al lancio */
+extern void releaseAsidFrames(int asid);
+extern int  residentSetSize(int asid);  /* frame privati residenti */
+extern int  forkAddressSpace(support_t *parent, support_t *child);
+extern int  mapRegion(support_t *sup, int line, int devNo, int blockNo, int count);
+extern int  unmapRegion(support_t *sup, memaddr addr);
+extern void unmapAllRegions(support_t *sup);
+extern memaddr allocFrames(int n);      /* frame fisici oltre lo Swap Pool */
+extern void checkReservedFrames(void);  /* frame riservati == previsti */
+extern void copyPage(memaddr dst, memaddr src);
+
+/* bufCache.c */
+extern void initBufCache(void);
+extern int  devBlockOp(int line, int devNo, int blockNo, memaddr frame, int write);
+extern unsigned int devBlockCount(int line, int devNo); /* blocchi del device */
+extern int  bcacheRead(int line, int devNo, int blockNo, memaddr dst);
+extern int  bcacheWrite(int line, int devNo, int blockNo, memaddr src);
+extern void bcacheFlush(void);
+extern int  bcacheFlushRange(int line, int devNo, int blockNo, int count);
+
+/* swapArea.c (swapPoolSem acquisito) */
+extern void initSwapArea(void);
+extern int  swapSlot(int asid, int p);  /* slot della pagina, -1 se nessuno */
+extern int  allocSlot(int asid, int p);
+extern void freeSlots(int asid);
+
+/* compCache.c */
+extern void initCompCache(void);
+extern int  zcacheStore(int asid, int p, memaddr frame);
+extern int  zcacheLoad(int asid, int p, memaddr frame);
+extern int  zcacheHas(int asid, int p);
+extern void zcacheFreeAsid(int asid);
+
+/* printSpool.c */
+extern void initPrintSpool(void);          /* spool + daemon per stampante */
+extern int  spoolPresent(int devNo);
+extern int  spoolWrite(int devNo, char *str, int len);
+extern void spoolDrain(void);
 
 /* sysSupport.c */
+extern void initBlockIO(void);             /* frame di I/O delle U-proc */
 extern void generalExceptionHandler(void); /* GENERALEXCEPT handler */
 extern void supTerminate(int asid);        /* terminazione ordinata di U-proc */
 
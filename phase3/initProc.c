@@ -17,24 +17,53 @@ int       shellSemaphore;             /* attesa figlio nella SYS6 (init 0)  */
 int       devMutex[DEV_MUTEX_TOTAL];  /* mutua esclusione sui device        */
 support_t supportPool[UPROCMAX];      /* una support struct per U-proc      */
 
+/* ASID occupati da una U-proc in esecuzione (lanciata con SYS6 o creata
+ * con fork) e mutex sulla loro assegnazione. */
+static int asidInUse[UPROCMAX];
+static int asidSem;
+
 /* Support structure pool*/
 
 support_t *getSupport(int asid) {
     return &supportPool[asid - 1];
 }
 
-/* Avvio di una U-proc*/
+/* Riserva l'ASID asid, o con asid = 0 il più alto libero (le fork
+ * lasciano così ai programmi lanciati dalla shell gli ASID bassi).
+ * Ritorna l'ASID riservato, -1 se è già occupato o non ce ne sono. */
+int claimAsid(int asid) {
+    int got = -1;
+
+    SYSCALL(PASSEREN, (int)&asidSem, 0, 0);
+    for (int a = UPROCMAX; a >= 1; a--) {
+        if ((asid == 0 || a == asid) && !asidInUse[a - 1]) {
+            asidInUse[a - 1] = 1;
+            got = a;
+            break;
+        }
+    }
+    SYSCALL(VERHOGEN, (int)&asidSem, 0, 0);
+    return got;
+}
 
-void launchUproc(int asid) {
-    support_t *sup = getSupport(asid);
+/* TRUE se l'ASID è occupato da una U-proc. */
+int asidActive(int asid) {
+    return asidInUse[asid - 1];
+}
 
-    /* Identità e Page Table. */
-    sup->sup_asid = asid;
-    initUprocPageTable(sup);
+/* Rende di nuovo disponibile l'ASID di una U-proc che termina. */
+void freeAsid(int asid) {
+    SYSCALL(PASSEREN, (int)&asidSem, 0, 0);
+    asidInUse[asid - 1] = 0;
+    SYSCALL(VERHOGEN, (int)&asidSem, 0, 0);
+}
+
+/* Avvio di una U-proc*/
 
-    /* Context per la gestione delle eccezioni passate su dal Nucleus.
-     *  [PGFAULTEXCEPT] : il Pager (TLB exception handler)
-     *  [GENERALEXCEPT] : il general exception handler                 */
+/* Context per la gestione delle eccezioni passate su dal Nucleus.
+ *  [PGFAULTEXCEPT] : il Pager (TLB exception handler)
+ *  [GENERALEXCEPT] : il general exception handler                 */
+void initExceptContexts(support_t *sup) {
     sup->sup_exceptContext[PGFAULTEXCEPT].pc       = (memaddr) pager;
     sup->sup_exceptContext[PGFAULTEXCEPT].status   = SUPPORT_STATUS;
     sup->sup_exceptContext[PGFAULTEXCEPT].stackPtr =
@@ -44,6 +73,25 @@ void launchUproc(int asid) {
     sup->sup_exceptContext[GENERALEXCEPT].status   = SUPPORT_STATUS;
     sup->sup_exceptContext[GENERALEXCEPT].stackPtr =
         (memaddr) &sup->sup_stackGen[499];
+}
+
+/* Avvia il programma del flash asid-1 come U-proc con quell'ASID, già
+ * riservato dal chiamante (claimAsid). */
+void launchUproc(int asid) {
+    support_t *sup = getSupport(asid);
+
+    /* Identità, Page Table e context degli handler. Una U-proc lanciata
+     * non ha padre: alla sua fine viene risvegliata la shell (o test). */
+    sup->sup_asid     = asid;
+    sup->sup_parent   = 0;
+    sup->sup_children = 0;
+    sup->sup_childSem = 0;
+    initUprocPageTable(sup);
+    initExceptContexts(sup);
+
+    /* Pagine toccate da ogni U-proc all'avvio (header e ingresso, .data,
+     * stack): caricate ora in un solo passo invece che con tre page fault. */
+    prefaultUproc(sup);
 
     /* Stato iniziale del processore della U-proc. */
     state_t s;
@@ -63,21 +111,45 @@ void launchUproc(int asid) {
 /* InstantiatorProcess (test) */
 
 void test(void) {
-    /* 1. Strutture dati della memoria virtuale (Swap Pool + semaforo). */
+    /* 1. Strutture dati della memoria virtuale (Swap Pool + semaforo,
+     *    area di swap sul disk, cache compressa), cache dei blocchi di
+     *    flash e disk e frame per l'I/O a blocchi delle U-proc. */
     initSwapStructs();
+    initSwapArea();
+    initCompCache();
+    initBufCache();
+    initBlockIO();
 
     /* 2. Semafori del Support Level. */
     masterSemaphore = 0;
     shellSemaphore  = 0;
     for (int i = 0; i < DEV_MUTEX_TOTAL; i++)
         devMutex[i] = 1;
-
-    /* 3. Avvio della shell (ASID 1). */
+    asidSem = 1;
+    for (int i = 0; i < UPROCMAX; i++)
+        asidInUse[i] = 0;
+
+    /* 3. Daemon del Support Level: spool delle stampanti installate (SYS3),
+     *    page-out dello Swap Pool e controllo del carico. Da qui in poi
+     *    nessuno chiede più frame ad allocFrames. */
+    initPrintSpool();
+    initPageoutDaemon();
+    initLoadControl();
+    checkReservedFrames();
+
+    /* 4. Avvio della shell (ASID 1). */
+    claimAsid(1);
     launchUproc(1);
 
-    /* 4. Attesa della terminazione della shell. */
+    /* 5. Attesa della terminazione della shell. */
     SYSCALL(PASSEREN, (int)&masterSemaphore, 0, 0);
 
-    /* 5. Conclusione: NSYS2 porta il Process Count a 0 -> HALT. */
+    /* 6. L'output ancora negli spool e i blocchi modificati rimasti in
+     *    cache vanno scritti sui device prima dello spegnimento. */
+    spoolDrain();
+    bcacheFlush();
+
+    /* 7. Conclusione: NSYS2 termina anche i daemon, figli di test; il
+     *    Process Count arriva a 0 -> HALT. */
     SYSCALL(TERMPROCESS, 0, 0, 0);
 }
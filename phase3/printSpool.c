@@ -0,0 +1,200 @@
+/*
+ * printSpool.c - Phase 3 / Level 4
+ *
+ * Spooler delle stampanti per la SYS3 (WritePrinter):
+ *   - un buffer circolare (spool) per ogni stampante installata
+ *   - un processo daemon per stampante che svuota lo spool con PRINTCHR,
+ *     risvegliato dagli interrupt di completamento del device
+ *   - attesa dello svuotamento degli spool prima dello spegnimento
+ *
+ * La U-proc che chiama la SYS3 copia la stringa nello spool e riprende
+ * subito; si blocca solo se lo spool è pieno. La stringa passa da un
+ * buffer sullo stack del kernel prima che il mutex dello spool sia preso:
+ * un page fault sulla stringa, anche fatale, avviene senza lock tenuti.
+ */
+
+#include "headers/support.h"
+
+/* Spool di una stampante. I semafori sp_work, sp_space e sp_drained
+ * partono da 0 e vengono incrementati solo se qualcuno vi è (o sta per
+ * esservi) bloccato, come indicato dai campi sp_idle/sp_waiters/sp_drain. */
+typedef struct spool_t {
+    char         sp_buf[SPOOL_SIZE];
+    int          sp_head;     /* prossimo carattere da stampare            */
+    int          sp_count;    /* caratteri in attesa nel buffer            */
+    int          sp_mutex;    /* mutua esclusione sui campi dello spool    */
+    int          sp_work;     /* il daemon attende nuovi caratteri         */
+    int          sp_idle;     /* il daemon è (o sta per essere) in attesa  */
+    int          sp_space;    /* le U-proc attendono spazio libero         */
+    int          sp_waiters;  /* U-proc in attesa su sp_space              */
+    int          sp_drained;  /* attesa dello svuotamento (spegnimento)    */
+    int          sp_drain;    /* qualcuno attende su sp_drained            */
+    int          sp_present;  /* stampante installata, daemon avviato      */
+    unsigned int sp_status;   /* status dell'ultima PRINTCHR fallita       */
+} spool_t;
+
+static spool_t spools[DEVPERINT];
+
+/* PRINTCHR fallite e caratteri scartati con esse, osservabili dal
+ * pannello Memory di µRISCV (il dettaglio in sp_status). */
+unsigned int spoolErrors;
+unsigned int spoolLost;
+
+/* Daemon */
+
+/* Corpo del daemon della stampante devNo (passato in a0 dallo stato
+ * iniziale). A ogni giro preleva dallo spool fino a SPOOL_BATCH caratteri,
+ * li stampa senza tenere il mutex dello spool, e risveglia le U-proc in
+ * attesa di spazio. Se una PRINTCHR fallisce il resto del blocco non
+ * viene stampato: l'errore e i caratteri persi sono registrati. */
+static void spoolerDaemon(int devNo) {
+    spool_t  *sp      = &spools[devNo];
+    dtpreg_t *printer = (dtpreg_t *) DEV_REG_ADDR(IL_PRINTER, devNo);
+    int       mutex   = PRINTER_MUTEX(devNo);
+    char      batch[SPOOL_BATCH];
+
+    while (1) {
+        SYSCALL(PASSEREN, (int)&sp->sp_mutex, 0, 0);
+        while (sp->sp_count == 0) {
+            if (sp->sp_drain) {
+                sp->sp_drain = 0;
+                SYSCALL(VERHOGEN, (int)&sp->sp_drained, 0, 0);
+            }
+            sp->sp_idle = 1;
+            SYSCALL(VERHOGEN, (int)&sp->sp_mutex, 0, 0);
+            SYSCALL(PASSEREN, (int)&sp->sp_work, 0, 0);
+            SYSCALL(PASSEREN, (int)&sp->sp_mutex, 0, 0);
+        }
+
+        int n = 0;
+        while (n < SPOOL_BATCH && sp->sp_count > 0) {
+            batch[n++] = sp->sp_buf[sp->sp_head];
+            sp->sp_head = (sp->sp_head + 1) % SPOOL_SIZE;
+            sp->sp_count--;
+        }
+        while (sp->sp_waiters > 0) {
+            sp->sp_waiters--;
+            SYSCALL(VERHOGEN, (int)&sp->sp_space, 0, 0);
+        }
+        SYSCALL(VERHOGEN, (int)&sp->sp_mutex, 0, 0);
+
+        SYSCALL(PASSEREN, (int)&devMutex[mutex], 0, 0);
+        for (int i = 0; i < n; i++) {
+            printer->data0 = (unsigned int)(unsigned char)batch[i];
+            unsigned int status =
+                SYSCALL(DOIO, (int)&printer->command, PRINTCHR, 0);
+            if ((status & 0xFF) != READY) {
+                sp->sp_status = status & 0xFF;
+                spoolErrors++;
+                spoolLost += n - i;
+                break;
+            }
+        }
+        SYSCALL(VERHOGEN, (int)&devMutex[mutex], 0, 0);
+    }
+}
+
+/* Inizializzazione */
+
+/* Prepara gli spool e avvia un daemon per ogni stampante installata.
+ * Va chiamata da test: i daemon sono suoi figli e vengono terminati con
+ * lui allo spegnimento. Gli stack sono riservati per tutte le DEVPERINT
+ * stampanti, così i frame chiesti ad allocFrames non dipendono da quelle
+ * installate (vedi SUPPORT_RESERVED_FRAMES). */
+void initPrintSpool(void) {
+    memaddr stacks = allocFrames(DEVPERINT);
+
+    spoolErrors = spoolLost = 0;
+    for (int dev = 0; dev < DEVPERINT; dev++) {
+        spool_t *sp = &spools[dev];
+        sp->sp_head = sp->sp_count = 0;
+        sp->sp_mutex = 1;
+        sp->sp_work = sp->sp_space = sp->sp_drained = 0;
+        sp->sp_idle = sp->sp_waiters = sp->sp_drain = 0;
+        sp->sp_status = READY;
+        sp->sp_present = DEV_INSTALLED(IL_PRINTER, dev);
+        if (!sp->sp_present)
+            continue;
+
+        state_t s;
+        for (unsigned int i = 0; i < (STATE_T_SIZE_IN_BYTES / WORDLEN); i++)
+            ((unsigned int *)&s)[i] = 0;
+
+        s.pc_epc = (memaddr) spoolerDaemon;
+        s.reg_sp = stacks + (dev + 1) * PAGESIZE;
+        s.reg_a0 = dev;
+        s.status = SUPPORT_STATUS;
+        s.mie    = MIE_ALL;
+        SYSCALL(CREATEPROCESS, (int)&s, PROCESS_PRIO_LOW, 0);
+    }
+}
+
+/* Interfaccia per la SYS3 */
+
+/* TRUE se la stampante devNo ha uno spool attivo. */
+int spoolPresent(int devNo) {
+    return devNo >= 0 && devNo < DEVPERINT && spools[devNo].sp_present;
+}
+
+/* Accoda len caratteri di str nello spool della stampante devNo. La
+ * stringa è letta a blocchi di SPOOL_BATCH caratteri in un buffer locale,
+ * senza alcun lock: un page fault sulla stringa, anche se termina la
+ * U-proc, non lascia preso sp_mutex (il daemon e spoolDrain resterebbero
+ * bloccati per sempre). Ogni blocco è poi copiato nello spool, tanti
+ * caratteri quanti ne entrano; il chiamante si blocca solo quando lo
+ * spool è pieno. Ritorna len. */
+int spoolWrite(int devNo, char *str, int len) {
+    spool_t *sp   = &spools[devNo];
+    int      done = 0;
+    char     batch[SPOOL_BATCH];
+
+    while (done < len) {
+        int n = (len - done < SPOOL_BATCH) ? len - done : SPOOL_BATCH;
+        for (int i = 0; i < n; i++)
+            batch[i] = str[done + i];
+
+        int k = 0;
+        SYSCALL(PASSEREN, (int)&sp->sp_mutex, 0, 0);
+        while (k < n) {
+            if (sp->sp_count == SPOOL_SIZE) {
+                sp->sp_waiters++;
+                SYSCALL(VERHOGEN, (int)&sp->sp_mutex, 0, 0);
+                SYSCALL(PASSEREN, (int)&sp->sp_space, 0, 0);
+                SYSCALL(PASSEREN, (int)&sp->sp_mutex, 0, 0);
+                continue;
+            }
+
+            int tail = (sp->sp_head + sp->sp_count) % SPOOL_SIZE;
+            while (k < n && sp->sp_count < SPOOL_SIZE) {
+                sp->sp_buf[tail] = batch[k++];
+                tail = (tail + 1) % SPOOL_SIZE;
+                sp->sp_count++;
+            }
+            if (sp->sp_idle) {
+                sp->sp_idle = 0;
+                SYSCALL(VERHOGEN, (int)&sp->sp_work, 0, 0);
+            }
+        }
+        SYSCALL(VERHOGEN, (int)&sp->sp_mutex, 0, 0);
+        done += n;
+    }
+    return len;
+}
+
+/* Attende che tutti gli spool siano stati stampati (usata da test prima
+ * dello spegnimento, altrimenti l'output accodato andrebbe perso). */
+void spoolDrain(void) {
+    for (int dev = 0; dev < DEVPERINT; dev++) {
+        spool_t *sp = &spools[dev];
+        if (!sp->sp_present)
+            continue;
+        SYSCALL(PASSEREN, (int)&sp->sp_mutex, 0, 0);
+        if (sp->sp_count > 0 || !sp->sp_idle) {
+            sp->sp_drain = 1;
+            SYSCALL(VERHOGEN, (int)&sp->sp_mutex, 0, 0);
+            SYSCALL(PASSEREN, (int)&sp->sp_drained, 0, 0);
+        } else {
+            SYSCALL(VERHOGEN, (int)&sp->sp_mutex, 0, 0);
+        }
+    }
+}
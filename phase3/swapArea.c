@@ -0,0 +1,134 @@
+/*
+ * swapArea.c - Phase 3 / Level 4
+ *
+ * Area di swap sul disk VMDISK, dove vanno le pagine private sfrattate
+ * sporche delle U-proc (i flash con le immagini dei programmi restano in
+ * sola lettura):
+ *   - uno slot (un blocco del disk) per ogni pagina che ha una copia
+ *     nell'area di swap, assegnato alla prima scrittura e tenuto fino alla
+ *     terminazione della U-proc
+ *   - allocazione a cluster: ogni ASID riempie un cluster di SWAP_CLUSTER
+ *     slot consecutivi prima di prenderne un altro, così le sue pagine
+ *     stanno sullo stesso cilindro e le scritture di una U-proc non
+ *     richiedono SEEK
+ *
+ * L'area occupa i blocchi 0..SWAP_SLOTS-1 del disk. Le funzioni vanno
+ * chiamate con swapPoolSem acquisito.
+ */
+
+#include "headers/support.h"
+
+#define SWAP_CLUSTERS (SWAP_SLOTS / SWAP_CLUSTER)
+
+/* Nessuno slot / nessun cluster. */
+#define NO_SLOT (-1)
+
+static int        (*slotOf)[UPROC_PAGES];         /* slot di ogni pagina  */
+static unsigned int slotUsed[SWAP_SLOTS / 32];      /* bitmap degli slot    */
+static int          clusterUsed[SWAP_CLUSTERS];     /* slot occupati        */
+static int          clusterOwner[SWAP_CLUSTERS];    /* ASID che lo riempie  */
+static int          curCluster[UPROCMAX];           /* cluster in uso       */
+
+/* Inizializzazione */
+
+/* Prepara l'area di swap. Il disk VMDISK è indispensabile: senza, nessuna
+ * pagina sporca potrebbe essere sfrattata (PANIC). La mappa slotOf, una
+ * word per ogni pagina di ogni U-proc, sta in frame presi con allocFrames
+ * come l'indice della cache compressa, non nella memoria statica del
+ * kernel. */
+void initSwapArea(void) {
+    if (!DEV_INSTALLED(IL_DISK, VMDISK) ||
+        devBlockCount(IL_DISK, VMDISK) < SWAP_SLOTS)
+        PANIC();
+
+    slotOf = (int (*)[UPROC_PAGES]) allocFrames(SWAP_MAP_FRAMES);
+    for (int a = 0; a < UPROCMAX; a++) {
+        curCluster[a] = NO_SLOT;
+        for (int p = 0; p < UPROC_PAGES; p++)
+            slotOf[a][p] = NO_SLOT;
+    }
+    for (int w = 0; w < SWAP_SLOTS / 32; w++)
+        slotUsed[w] = 0;
+    for (int c = 0; c < SWAP_CLUSTERS; c++)
+        clusterUsed[c] = clusterOwner[c] = 0;
+    vmStats.vs_swapSlots = vmStats.vs_swapPeak = 0;
+}
+
+/* Gestione degli slot */
+
+static inline int slotBusy(int s) {
+    return (slotUsed[s / 32] >> (s % 32)) & 1;
+}
+
+/* Primo slot libero del cluster c, NO_SLOT se è pieno. */
+static int freeSlotIn(int c) {
+    for (int s = c * SWAP_CLUSTER; s < (c + 1) * SWAP_CLUSTER; s++)
+        if (!slotBusy(s))
+            return s;
+    return NO_SLOT;
+}
+
+/* Libera lo slot s; un cluster che si svuota torna disponibile per
+ * qualsiasi ASID. */
+static void releaseSlot(int s) {
+    int c = s / SWAP_CLUSTER;
+
+    slotUsed[s / 32] &= ~(1u << (s % 32));
+    vmStats.vs_swapSlots--;
+    if (--clusterUsed[c] == 0 && clusterOwner[c] != 0) {
+        if (curCluster[clusterOwner[c] - 1] == c)
+            curCluster[clusterOwner[c] - 1] = NO_SLOT;
+        clusterOwner[c] = 0;
+    }
+}
+
+/* Interfaccia per il Pager */
+
+/* Slot della pagina p della U-proc asid, NO_SLOT se la pagina non è mai
+ * stata scritta nell'area di swap. */
+int swapSlot(int asid, int p) {
+    return slotOf[asid - 1][p];
+}
+
+/* Slot della pagina p della U-proc asid, assegnato se non ne ha ancora
+ * uno: nel cluster che l'ASID sta riempiendo, altrimenti in un cluster
+ * vuoto che diventa suo; solo se nessun cluster è vuoto, nel primo slot
+ * libero. Ritorna NO_SLOT se l'area di swap è piena. */
+int allocSlot(int asid, int p) {
+    int *slot = &slotOf[asid - 1][p];
+    if (*slot != NO_SLOT)
+        return *slot;
+
+    int c = curCluster[asid - 1];
+    int s = (c != NO_SLOT) ? freeSlotIn(c) : NO_SLOT;
+
+    for (c = 0; s == NO_SLOT && c < SWAP_CLUSTERS; c++) {
+        if (clusterUsed[c] == 0) {
+            clusterOwner[c]      = asid;
+            curCluster[asid - 1] = c;
+            s = c * SWAP_CLUSTER;
+        }
+    }
+    for (c = 0; s == NO_SLOT && c < SWAP_CLUSTERS; c++)
+        s = freeSlotIn(c);
+    if (s == NO_SLOT)
+        return NO_SLOT;
+
+    slotUsed[s / 32] |= 1u << (s % 32);
+    clusterUsed[s / SWAP_CLUSTER]++;
+    if (++vmStats.vs_swapSlots > vmStats.vs_swapPeak)
+        vmStats.vs_swapPeak = vmStats.vs_swapSlots;
+    *slot = s;
+    return s;
+}
+
+/* Libera tutti gli slot della U-proc asid (terminazione). */
+void freeSlots(int asid) {
+    for (int p = 0; p < UPROC_PAGES; p++) {
+        if (slotOf[asid - 1][p] != NO_SLOT) {
+            releaseSlot(slotOf[asid - 1][p]);
+            slotOf[asid - 1][p] = NO_SLOT;
+        }
+    }
+    curCluster[asid - 1] = NO_SLOT;
+}
@@ -4,25 +4,46 @@
  * Handler del Support Level per le eccezioni "non-TLB" passate su dal
  * Nucleus:
  *   - General Exception Handler (smista syscall e program trap)
- *   - SYSCALL Handler (SYS2 Terminate, SYS4 Write, SYS5 Read, SYS6 Execute)
+ *   - SYSCALL Handler (SYS2 Terminate, SYS3 WritePrinter, SYS4 Write,
+ *     SYS5 Read, SYS6 Execute, SYS7..SYS10 I/O a blocchi su disk e flash,
+ *     SYS11 Fork, SYS12 Sbrk, SYS13..SYS15 regioni di device mappate)
  *   - Program Trap Handler (terminazione ordinata)
  */
 
 #include "headers/support.h"
 /* Terminazione ordinata di una U-proc*/
 void supTerminate(int asid) {
+    support_t *sup = getSupport(asid);
+
+    /* I figli creati con fork sono figli anche per il Nucleus: la NSYS2
+     * li terminerebbe senza liberarne i frame. Si attende che finiscano. */
+    for (; sup->sup_children > 0; sup->sup_children--)
+        SYSCALL(PASSEREN, (int)&sup->sup_childSem, 0, 0);
+
+    /* Le pagine modificate delle regioni mappate vanno sul device. */
+    unmapAllRegions(sup);
+
     /* Libera i frame dello Swap Pool occupati da questa U-proc, per
      * evitare scritture spurie sul backing store in futuro. */
+    releaseAsidFrames(asid);
+    freeAsid(asid);
+
+    /* Tempo di CPU della U-proc, per i refill per istruzione: GETTIME
+     * ritorna p_time, accumulato dal Nucleus con STCK, cioè in µs (TOD
+     * già diviso per TIMESCALE). vmStats è aggiornato sotto swapPoolSem
+     * come dal Pager. */
+    unsigned int cpuTime = SYSCALL(GETTIME, 0, 0, 0);
     SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
-    for (int i = 0; i < SWAP_POOL_SIZE; i++)
-        if (swapPool[i].sw_asid == asid)
-            swapPool[i].sw_asid = SWAP_FRAME_FREE;
+    vmStats.vs_uprocTime += cpuTime;
     SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
 
     /* Sblocca chi attende la conclusione di questa U-proc:
+     *  un figlio creato con fork: il padre via sup_childSem
      *  la shell (ASID 1): InstantiatorProcess via masterSemaphore
      *  una U-proc figlia: la shell via shellSemaphore                */
-    if (asid == 1)
+    if (sup->sup_parent != 0)
+        SYSCALL(VERHOGEN, (int)&getSupport(sup->sup_parent)->sup_childSem, 0, 0);
+    else if (asid == 1)
         SYSCALL(VERHOGEN, (int)&masterSemaphore, 0, 0);
     else
         SYSCALL(VERHOGEN, (int)&shellSemaphore, 0, 0);
@@ -31,6 +52,21 @@ void supTerminate(int asid) {
     SYSCALL(TERMPROCESS, 0, 0, 0);
 }
 
+/* SYS3 - WritePrinter*/
+
+/* Accoda la stringa nello spool della stampante della U-proc (devNo =
+ * asid - 1): la stampa vera e propria è a carico del daemon dello spool,
+ * quindi la U-proc riprende senza attendere il device. */
+static int writePrinter(support_t *sup, char *virtAddr, int len) {
+    int devNo = sup->sup_asid - 1;
+
+    if ((memaddr)virtAddr < KUSEG || (memaddr)virtAddr >= USERSTACKTOP ||
+        len < 0 || len > MAXSTRLEN || !spoolPresent(devNo)) {
+        supTerminate(sup->sup_asid); /* non ritorna */
+    }
+    return spoolWrite(devNo, virtAddr, len);
+}
+
 /* SYS4 - WriteTerminal*/
 static int writeTerminal(support_t *sup, char *virtAddr, int len) {
     /* Validazione: indirizzo dentro lo spazio logico, lunghezza valida. */
@@ -94,7 +130,8 @@ static int readTerminal(support_t *sup, char *virtAddr) {
 /* SYS6 - Execute (spawn di una nuova U-proc; usato dalla shell) */
 
 static int doExecute(int asid) {
-    if (asid < 1 || asid > UPROCMAX)
+    /* L'ASID può essere occupato da un figlio creato con fork. */
+    if (asid < 1 || asid > UPROCMAX || claimAsid(asid) < 0)
         return -1;
     launchUproc(asid);
     /* La shell si blocca finché la U-proc figlia non termina. */
@@ -102,6 +139,146 @@ static int doExecute(int asid) {
     return 0;
 }
 
+/* SYS11 - Fork */
+
+/* Crea una copia della U-proc chiamante con un ASID libero: il figlio
+ * riprende dopo la ecall come il padre, con gli stessi registri e lo
+ * stesso spazio di indirizzamento, condiviso copy-on-write (vedi
+ * forkAddressSpace). Ritorna al padre l'ASID del figlio e al figlio 0, o
+ * -1 se non ci sono ASID o PCB liberi o la copia del backing store
+ * fallisce. Il padre, se termina, attende prima la fine dei figli. */
+static int doFork(support_t *sup, state_t *state) {
+    int c = claimAsid(0);
+    if (c < 0)
+        return -1;
+
+    support_t *child = getSupport(c);
+    child->sup_asid     = c;
+    child->sup_parent   = sup->sup_asid;
+    child->sup_children = 0;
+    child->sup_childSem = 0;
+    initExceptContexts(child);
+    if (!forkAddressSpace(sup, child)) {
+        freeAsid(c);
+        return -1;
+    }
+
+    state_t s;
+    for (unsigned int i = 0; i < (STATE_T_SIZE_IN_BYTES / WORDLEN); i++)
+        ((unsigned int *)&s)[i] = ((unsigned int *)state)[i];
+    s.reg_a0   = 0;
+    s.pc_epc  += WORDLEN;
+    s.entry_hi = c << ASIDSHIFT;
+
+    sup->sup_children++;
+    if ((int)SYSCALL(CREATEPROCESS, (int)&s, PROCESS_PRIO_LOW, (int)child) < 0) {
+        sup->sup_children--;
+        releaseAsidFrames(c);
+        freeAsid(c);
+        return -1;
+    }
+    return c;
+}
+
+/* SYS12 - Sbrk */
+
+/* Estende lo heap della U-proc di incr byte e ritorna il break precedente,
+ * cioè l'inizio della nuova area, o -1 se incr è negativo o lo heap
+ * supererebbe HEAP_END. Nessun frame viene assegnato qui: le nuove pagine
+ * sono zero-fill e il Pager le crea al primo accesso. */
+static int doSbrk(support_t *sup, int incr) {
+    memaddr old = sup->sup_brk;
+
+    if (incr < 0 || (unsigned int)incr > HEAP_END - old)
+        return -1;
+    sup->sup_brk += incr;
+    return (int)old;
+}
+
+/* SYS7..SYS10 - I/O a blocchi su disk e flash */
+
+/* Frame "bounce" di ogni U-proc (indice asid - 1): i dati passano sempre
+ * da un frame del kernel, mai da una pagina della U-proc, che potrebbe non
+ * essere residente o venire sfrattata durante il DMA. Il frame è della
+ * sola U-proc, che esegue una syscall per volta: la copia frame <-> buffer
+ * utente avviene senza alcun semaforo acquisito, e un page fault sul
+ * buffer, anche se termina la U-proc, non blocca nessun altro. */
+static memaddr bounceFrame[UPROCMAX];
+
+void initBlockIO(void) {
+    memaddr base = allocFrames(UPROCMAX);
+    for (int i = 0; i < UPROCMAX; i++)
+        bounceFrame[i] = base + i * PAGESIZE;
+}
+
+/* Trasferisce count blocchi consecutivi tra il buffer utente virtAddr e il
+ * device (line, devNo) a partire da blockNo, attraverso il frame bounce
+ * della U-proc; le scritture sono assorbite dalla cache write-back e le
+ * letture sequenziali su disk non ripetono il SEEK. Ritorna il numero di blocchi trasferiti, o lo status
+ * del device cambiato di segno in caso di errore. */
+static int blockIO(support_t *sup, int line, int write, memaddr virtAddr,
+                   unsigned int devArg, int blockNo) {
+    int devNo = BLKARG_DEV(devArg);
+    int count = BLKARG_COUNT(devArg);
+
+    /* Validazione: device presente, buffer allineato e tutto dentro lo
+     * spazio logico, blocchi di flash dell'immagine del programma non
+     * scrivibili, area di swap del disk non accessibile. */
+    if (devNo >= DEVPERINT || !DEV_INSTALLED(line, devNo) ||
+        count < 1 || blockNo < 0 || (virtAddr & (WORDLEN - 1)) != 0 ||
+        virtAddr < KUSEG || virtAddr >= USERSTACKTOP ||
+        (USERSTACKTOP - virtAddr) / PAGESIZE < (unsigned int)count ||
+        (line == IL_FLASH && write && blockNo < BACKING_BLOCKS) ||
+        (line == IL_DISK && devNo == VMDISK && blockNo < SWAP_SLOTS)) {
+        supTerminate(sup->sup_asid); /* non ritorna */
+    }
+
+    memaddr bounce = bounceFrame[sup->sup_asid - 1];
+    int     done;
+
+    for (done = 0; done < count; done++) {
+        memaddr user = virtAddr + done * PAGESIZE;
+        int     st;
+        if (write) {
+            copyPage(bounce, user);
+            st = bcacheWrite(line, devNo, blockNo + done, bounce);
+        } else {
+            st = bcacheRead(line, devNo, blockNo + done, bounce);
+            if (st == READY)
+                copyPage(user, bounce);
+        }
+        if (st != READY)
+            return -st;
+    }
+    return done;
+}
+
+/* SYS13/SYS14 - DiskMap/FlashMap, SYS15 - Unmap */
+
+/* Mappa count blocchi consecutivi del device (line, devNo), a partire da
+ * blockNo, nella finestra delle regioni della U-proc: da lì in poi il
+ * Pager carica le pagine direttamente dai blocchi e vi riscrive quelle
+ * modificate (vedi mapRegion). Gli argomenti sono quelli di SYS7..SYS10,
+ * senza il buffer. Ritorna l'indirizzo della regione o -1. */
+static int mapDevice(support_t *sup, int line, unsigned int devArg,
+                     int blockNo) {
+    int devNo = BLKARG_DEV(devArg);
+    int count = BLKARG_COUNT(devArg);
+
+    /* Validazione come per blockIO: i blocchi di flash dell'immagine non
+     * sono mappabili, perché le pagine vi verrebbero scritte. La regione
+     * deve inoltre stare tutta nel device: un blocco oltre la fine
+     * fallirebbe solo al page fault, a regione già in uso. */
+    if (devNo >= DEVPERINT || !DEV_INSTALLED(line, devNo) ||
+        count < 1 || blockNo < 0 ||
+        (unsigned int)blockNo + count > devBlockCount(line, devNo) ||
+        (line == IL_FLASH && blockNo < BACKING_BLOCKS) ||
+        (line == IL_DISK && devNo == VMDISK && blockNo < SWAP_SLOTS)) {
+        supTerminate(sup->sup_asid); /* non ritorna */
+    }
+    return mapRegion(sup, line, devNo, blockNo, count);
+}
+
 /* SYSCALL Handler*/
 
 static void supSyscallHandler(support_t *sup, state_t *state) {
@@ -113,6 +290,11 @@ static void supSyscallHandler(support_t *sup, state_t *state) {
             supTerminate(sup->sup_asid); /* non ritorna */
             return;
 
+        case SUP_WRITEPRINTER:
+            result = writePrinter(sup, (char *)state->reg_a1,
+                                  (int)state->reg_a2);
+            break;
+
         case SUP_WRITETERMINAL:
             result = writeTerminal(sup, (char *)state->reg_a1,
                                    (int)state->reg_a2);
@@ -126,6 +308,36 @@ static void supSyscallHandler(support_t *sup, state_t *state) {
             result = doExecute((int)state->reg_a1);
             break;
 
+        case SUP_FORK:
+            result = doFork(sup, state);
+            break;
+
+        case SUP_SBRK:
+            result = doSbrk(sup, (int)state->reg_a1);
+            break;
+
+        case SUP_DISKMAP:
+        case SUP_FLASHMAP:
+            result = mapDevice(sup,
+                               (number == SUP_DISKMAP) ? IL_DISK : IL_FLASH,
+                               state->reg_a1, (int)state->reg_a2);
+            break;
+
+        case SUP_UNMAP:
+            result = unmapRegion(sup, (memaddr)state->reg_a1);
+            break;
+
+        case SUP_DISKPUT:
+        case SUP_DISKGET:
+        case SUP_FLASHPUT:
+        case SUP_FLASHGET:
+            result = blockIO(sup,
+                             (number <= SUP_DISKGET) ? IL_DISK : IL_FLASH,
+                             (number == SUP_DISKPUT || number == SUP_FLASHPUT),
+                             (memaddr)state->reg_a1, state->reg_a2,
+                             (int)state->reg_a3);
+            break;
+
         default:
             /* SYSCALL non riconosciuta: trattata come program trap. */
             supTerminate(sup->sup_asid); /* non ritorna */
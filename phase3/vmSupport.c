@@ -4,18 +4,83 @@
  * Gestione della memoria virtuale del Support Level:
  *   - Swap Pool table e relativo semaforo di mutua esclusione
  *   - il Pager (TLB exception handler per i page fault)
- *   - lettura/scrittura del backing store (device flash)
+ *   - lettura/scrittura del backing store (device flash, tramite la
+ *     cache dei blocchi di bufCache.c)
  *   - inizializzazione della Page Table di una U-proc
+ *   - condivisione delle pagine di .text tra istanze dello stesso programma
+ *   - duplicazione copy-on-write dello spazio di indirizzamento (fork)
+ *   - il daemon di page-out, che mantiene una riserva di frame liberi
+ *   - fault minori: rimappatura dei frame sfrattati non ancora riusati
+ *   - allocazione dei frame fisici oltre lo Swap Pool
  */
 
 #include "headers/support.h"
+#include <uriscv/aout.h>
 
 /* Variabili globali della memoria virtuale*/
-int    swapPoolSem;
-swap_t swapPool[SWAP_POOL_SIZE];
+int       swapPoolSem;
+swap_t   *swapPool;
+int       swapPoolSize;
+vmstats_t vmStats;
+int       replacementPolicy = REPLACEMENT_POLICY;
+int       readAheadOn       = READ_AHEAD;
+int       prefaultOnLaunch  = PREFAULT_ON_LAUNCH;
+int       wsQuotas          = WS_QUOTAS;
+int       loadControl       = LOAD_CONTROL;
+int       frameReclaim      = FRAME_RECLAIM;
 
 /* Indice FIFO per l'algoritmo di rimpiazzo pagine (round robin).*/
 static int fifoNext = 0;
+/* Lancetta dell'algoritmo Clock (second chance). */
+static int clockHand = 0;
+
+/* Frame liberi nello Swap Pool e soglie del daemon di page-out: quando i
+ * frame liberi scendono sotto pageoutLow il daemon viene risvegliato e
+ * sfratta pagine finché non tornano almeno pageoutHigh. */
+static int swapFreeCount;
+int        pageoutLow  = PAGEOUT_LOW;
+int        pageoutHigh = PAGEOUT_HIGH;
+static int pageoutSem;   /* il daemon attende qui di essere risvegliato */
+static int pageoutIdle;  /* il daemon è (o sta per essere) in attesa    */
+
+/* Layout delle immagini dei programmi, per device flash di backing: pagine
+ * di solo .text (condivisibili) e prima pagina zero-fill. Sono lette
+ * dall'header aout al primo caricamento della pagina 0 e valgono per tutte
+ * le esecuzioni successive (-1 finché ignote). */
+static int imgTextPages[DEVPERINT];
+static int imgZeroFrom[DEVPERINT];
+
+/* Prossimo frame libero oltre lo Swap Pool (vedi allocFrames): fissato
+ * da initSwapStructs una volta dimensionato lo Swap Pool. reservedBase è
+ * il primo dei SUPPORT_RESERVED_FRAMES frame, subito dopo la tabella. */
+static memaddr nextFreeFrame = 0;
+static memaddr reservedBase  = 0;
+
+/* Numero d'ordine dell'ultima U-proc avviata (lancio o fork): il
+ * controllo del carico sospende per prime le più recenti. */
+static unsigned int launchSeq;
+
+/* Frame occupati da più U-proc (.text condiviso e COW), che non stanno
+ * nella lista sup_resident di nessuna (vedi setFrameAsid). */
+static struct list_head sharedFrames;
+
+/* Frame liberi che contengono ancora la pagina sfrattata per ultima (vedi
+ * releaseReclaimable), dal più vecchio: riusati solo quando non restano
+ * frame liberi vuoti. */
+static struct list_head reclaimFrames;
+
+/* ASID (TLBASIDBIT) con una serie di invalidazioni in corso: le loro
+ * entry nel TLB sono tolte tutte insieme alla fine (tlbBatchEnd). */
+static unsigned int tlbBatchMask;
+
+/* Frame per le tabelle di secondo livello delle Page Table non in uso. */
+static pteEntry_t *pgTblFree[PGTBL_FRAMES];
+static int         pgTblFreeCount;
+
+/* Frame di appoggio per copiare sul backing store del figlio le pagine
+ * del padre non residenti durante una fork, e relativo mutex. */
+static memaddr forkFrame;
+static int     forkSem;
 
 /* Utility*/
 
@@ -28,157 +93,1966 @@ static inline void interruptsOn(void) {
     setSTATUS(getSTATUS() | MSTATUS_MIE_MASK);
 }
 
-/* Dato l'EntryHI salvato, ritorna l'indice [0..31] nella Page Table.
- * Le pagine 0..30 corrispondono ai VPN 0x80000..0x8001E, la pagina di
- * stack (indice 31) al VPN 0xBFFFF. Ritorna -1 se il VPN è fuori range. */
+/* Dato l'EntryHI salvato, ritorna l'indice p della pagina: immagine e
+ * heap dal VPN 0x80000 in su, stack dal VPN 0xBFFFF in giù, regioni
+ * mappate da MMAP_START (indici da UPROC_MMAPBASE). Ritorna -1 se il VPN è
+ * fuori da tutte le regioni. */
 static int vpnToIndex(unsigned int entryHI) {
-    unsigned int vpn = (entryHI >> VPNSHIFT) & 0xFFFFF;
-    if (vpn == KUSEG_STACK_VPN)
-        return UPROC_STACKPAGE;
-    if (vpn >= KUSEG_VPN_START && vpn < KUSEG_VPN_START + UPROC_TEXTPAGES)
+    unsigned int vpn  = (entryHI >> VPNSHIFT) & 0xFFFFF;
+    unsigned int mmap = MMAP_START >> VPNSHIFT;
+    if (vpn >= KUSEG_VPN_START && vpn < KUSEG_VPN_START + UPROC_STACKBASE)
         return (int)(vpn - KUSEG_VPN_START);
+    if (vpn >= mmap && vpn < mmap + UPROC_MMAPPAGES)
+        return UPROC_MMAPBASE + (int)(vpn - mmap);
+    if (vpn <= KUSEG_STACK_VPN && vpn > KUSEG_STACK_VPN - UPROC_STACKPAGES)
+        return UPROC_STACKBASE + (int)(KUSEG_STACK_VPN - vpn);
     return -1;
 }
 
+/* VPN della pagina di indice p (inverso di vpnToIndex). */
+static inline unsigned int indexToVpn(int p) {
+    if (p < UPROC_STACKBASE)
+        return KUSEG_VPN_START + p;
+    if (p >= UPROC_MMAPBASE)
+        return (MMAP_START >> VPNSHIFT) + (p - UPROC_MMAPBASE);
+    return KUSEG_STACK_VPN - (p - UPROC_STACKBASE);
+}
+
 /* Indirizzo fisico del frame i dello Swap Pool.*/
 static inline memaddr frameAddr(int i) {
     return (memaddr)(SWAP_POOL_START + i * PAGESIZE);
 }
 
-/* Invalida un'entry di Page Table e azzera il TLB in modo atomico.*/
+/* Indice nello Swap Pool del frame mappato da una entry di Page Table. */
+static inline int frameIndex(unsigned int entryLO) {
+    return (int)(((entryLO & ENTRYLO_PFN_MASK) - SWAP_POOL_START) / PAGESIZE);
+}
+
+/* Page Table a due livelli
+ *
+ * La directory sup_pgDir ha una entry per ogni blocco di PGTBL_ENTRIES
+ * pagine di kuseg; la tabella di secondo livello, un frame preso da
+ * pgTblFree, esiste solo se la U-proc ha toccato una pagina del blocco. Il
+ * TLB-Refill fa la stessa traduzione (vedi uTLB_RefillHandler) e per una
+ * tabella assente installa un'entry non valida: il fault arriva al Pager,
+ * che crea la tabella. */
+
+/* Bit software iniziali dell'entry della pagina p di sup: heap e stack
+ * partono vuoti (zero-fill), le regioni mappate si leggono dal device; per
+ * l'immagine vale il layout, se noto (vedi applyImage). */
+static unsigned int initialFlags(support_t *sup, int p) {
+    if (p >= UPROC_MMAPBASE)
+        return 0;
+    if (p >= UPROC_HEAPBASE)
+        return PTE_ZEROFILL;
+    if (sup->sup_zeroFrom < 0)
+        return 0;
+    if (p < imgTextPages[sup->sup_imgDev])
+        return PTE_SHARED;
+    if (p >= sup->sup_zeroFrom)
+        return PTE_ZEROFILL;
+    return 0;
+}
+
+/* Assegna a sup la tabella di secondo livello d (swapPoolSem acquisito),
+ * con tutte le pagine non presenti. Ritorna NULL se i frame per le tabelle
+ * sono esauriti. */
+static pteEntry_t *newPageTable(support_t *sup, int d) {
+    if (pgTblFreeCount == 0)
+        return NULL;
+    pteEntry_t *tbl = pgTblFree[--pgTblFreeCount];
+
+    for (int k = 0; k < PGTBL_ENTRIES; k++) {
+        unsigned int vpn = KUSEG_VPN_START + (d << PGTBL_SHIFT) + k;
+        int          p   = vpnToIndex(vpn << VPNSHIFT);
+        tbl[k].pte_entryHI = (vpn << VPNSHIFT) | (sup->sup_asid << ASIDSHIFT);
+        tbl[k].pte_entryLO = (p >= 0) ? initialFlags(sup, p) : 0;
+    }
+    sup->sup_pgDir[d] = tbl;
+    return tbl;
+}
+
+/* Entry di Page Table della pagina p di sup. Se la sua tabella di secondo
+ * livello non esiste ancora viene creata con alloc (swapPoolSem
+ * acquisito), altrimenti ritorna NULL; NULL anche se le tabelle sono
+ * esaurite. */
+static pteEntry_t *pageTableEntry(support_t *sup, int p, int alloc) {
+    unsigned int rel = indexToVpn(p) - KUSEG_VPN_START;
+    pteEntry_t  *tbl = sup->sup_pgDir[rel >> PGTBL_SHIFT];
+
+    if (tbl == NULL && alloc)
+        tbl = newPageTable(sup, rel >> PGTBL_SHIFT);
+    if (tbl == NULL)
+        return NULL;
+    return &tbl[rel & (PGTBL_ENTRIES - 1)];
+}
+
+/* Restituisce a pgTblFree le tabelle di secondo livello di sup. */
+static void freePageTables(support_t *sup) {
+    for (int d = 0; d < PGDIR_ENTRIES; d++) {
+        if (sup->sup_pgDir[d] != NULL) {
+            pgTblFree[pgTblFreeCount++] = sup->sup_pgDir[d];
+            sup->sup_pgDir[d] = NULL;
+        }
+    }
+}
+
+/* Gestione mirata del TLB (interrupt disabilitati). Invece di svuotare
+ * l'intero TLB con TLBCLR, che costringerebbe ogni U-proc a ricaricare
+ * tutto il proprio working set tramite il TLB-Refill, si cerca con TLBP la
+ * sola entry della pagina (VPN + ASID) e la si sovrascrive con TLBWI.
+ * EntryHI è salvato e ripristinato: contiene anche l'ASID corrente. */
+
+/* Scrive nel TLB la traduzione della pte: al posto della vecchia entry
+ * della stessa pagina se presente, altrimenti in un'entry non riservata
+ * (tlbWriteFree). */
+static void tlbUpdate(pteEntry_t *pte) {
+    unsigned int savedHI = getENTRYHI();
+
+    setENTRYHI(pte->pte_entryHI);
+    TLBP();
+    setENTRYLO(pte->pte_entryLO);
+    if (getINDEX() & PRESENTFLAG)
+        tlbWriteFree(pte->pte_entryHI);
+    else
+        TLBWI();
+    setENTRYHI(savedHI);
+}
+
+/* Toglie dal TLB l'eventuale entry della pte, sostituendola con una
+ * entry non valida su un VPN non tradotto (TLB_NOMATCH_HI): il prossimo
+ * accesso alla pagina passa per il TLB-Refill. La TLBP è evitata se
+ * l'ASID non può avere entry nel TLB, o se una serie di invalidazioni in
+ * corso lo pulirà comunque per intero. */
+static void tlbInvalidate(pteEntry_t *pte) {
+    unsigned int bit = TLBASIDBIT(ENTRYHI_ASID(pte->pte_entryHI));
+    if (tlbBatchMask & bit) {
+        vmStats.vs_tlbBatched++;
+        return;
+    }
+    if (!(tlbAsidMask & bit)) {
+        vmStats.vs_tlbSkipped++;
+        return;
+    }
+
+    unsigned int savedHI = getENTRYHI();
+
+    setENTRYHI(pte->pte_entryHI);
+    TLBP();
+    if (!(getINDEX() & PRESENTFLAG)) {
+        setENTRYHI(TLB_NOMATCH_HI(getINDEX() >> INDEXSHIFT));
+        setENTRYLO(0);
+        TLBWI();
+        vmStats.vs_tlbInvals++;
+    }
+    setENTRYHI(savedHI);
+}
+
+/* Toglie dal TLB tutte le entry della U-proc asid con una sola scansione
+ * delle TLB_SIZE entry (TLBR), invece di una TLBP per pagina. Dopo la
+ * scansione l'ASID non ha più entry nel TLB. Senza il layout di Index
+ * (TLB_INDEX_KNOWN) la scansione non è possibile e si svuota il TLB. */
+static void tlbSweep(int asid) {
+    unsigned int savedHI = getENTRYHI();
+
+    interruptsOff();
+#if TLB_INDEX_KNOWN
+    for (unsigned int k = 0; k < TLB_SIZE; k++) {
+        setINDEX(k << INDEXSHIFT);
+        TLBR();
+        if (ENTRYHI_ASID(getENTRYHI()) == (unsigned int)asid) {
+            setENTRYHI(TLB_NOMATCH_HI(k));
+            setENTRYLO(0);
+            TLBWI();
+            vmStats.vs_tlbInvals++;
+        }
+    }
+    tlbAsidMask &= ~TLBASIDBIT(asid);
+#else
+    TLBCLR();
+    tlbAsidMask = 0;
+#endif
+    setENTRYHI(savedHI);
+    interruptsOn();
+    vmStats.vs_tlbSweeps++;
+}
+
+/* Serie di invalidazioni delle pagine della U-proc asid (sospensione,
+ * terminazione): tra tlbBatchBegin e tlbBatchEnd tlbInvalidate non tocca
+ * il TLB per l'ASID, che alla fine viene pulito con tlbSweep. La U-proc
+ * non esegue codice utente nel frattempo, quindi non usa le entry rimaste. */
+static void tlbBatchBegin(int asid) {
+    tlbBatchMask |= TLBASIDBIT(asid);
+}
+
+static void tlbBatchEnd(int asid) {
+    tlbSweep(asid);
+    tlbBatchMask &= ~TLBASIDBIT(asid);
+}
+
+/* Invalida un'entry di Page Table e la sua entry nel TLB in modo
+ * atomico.*/
 static void markPageNotValid(pteEntry_t *pte) {
     interruptsOff();
     pte->pte_entryLO &= ~VALIDON;
-    TLBCLR();
+    tlbInvalidate(pte);
     interruptsOn();
 }
 
 /* Rende presente un'entry di Page Table (PFN + V) e aggiorna il TLB in
- * modo atomico. Oltre ad azzerare le entry stantie con TLBCLR, l'entry
- * appena resa valida viene scritta DIRETTAMENTE nel TLB (TLBWR): così
- * l'accesso che riprende subito dopo trova già la traduzione valida senza
- * dover passare per un evento di TLB-Refill (che in alcune situazioni non
- * viene rigenerato, lasciando il processo in page-fault loop). */
-static void markPagePresent(pteEntry_t *pte, memaddr phys) {
+ * modo atomico. L'entry appena resa valida viene scritta DIRETTAMENTE nel
+ * TLB (tlbUpdate): così l'accesso che riprende subito dopo trova già la
+ * traduzione valida senza dover passare per un evento di TLB-Refill (che
+ * in alcune situazioni non viene rigenerato, lasciando il processo in
+ * page-fault loop).
+ * La pagina è mappata in sola lettura (D=0) a meno che dirty sia vero: la
+ * prima scrittura genera un TLB-Modification che la marca sporca. */
+static void markPagePresent(pteEntry_t *pte, memaddr phys, int dirty) {
     interruptsOff();
-    pte->pte_entryLO = phys | DIRTYON | VALIDON;
-    TLBCLR();
-    setENTRYHI(pte->pte_entryHI);
-    setENTRYLO(pte->pte_entryLO);
-    TLBWR();
+    pte->pte_entryLO = phys | VALIDON | PTE_REFERENCED | (dirty ? DIRTYON : 0) |
+                       (pte->pte_entryLO & (PTE_ZEROFILL | PTE_SHARED | PTE_COW));
+    tlbUpdate(pte);
+    interruptsOn();
+}
+
+/* Accende il bit D di una pagina presente e aggiorna il TLB (atomico). */
+static void markPageDirty(pteEntry_t *pte) {
+    interruptsOff();
+    pte->pte_entryLO |= DIRTYON;
+    tlbUpdate(pte);
     interruptsOn();
 }
 
-/* Inizializzazione*/                                                    
+/* TRUE se il page fault è stato causato da una scrittura. */
+static inline int isStoreFault(unsigned int excCode) {
+    return excCode == EXC_SPF || excCode == EXC_TLBS || excCode == EXC_UTLBS;
+}
+
+/* Azzera un frame fisico, una word alla volta. */
+static void zeroPage(memaddr dst) {
+    unsigned int *d = (unsigned int *) dst;
+    for (int i = 0; i < PAGESIZE / WORDLEN; i++)
+        d[i] = 0;
+}
+
+/* Copia un frame fisico (PAGESIZE byte) su un altro, una word alla volta. */
+void copyPage(memaddr dst, memaddr src) {
+    unsigned int *d = (unsigned int *) dst;
+    unsigned int *s = (unsigned int *) src;
+    for (int i = 0; i < PAGESIZE / WORDLEN; i++)
+        d[i] = s[i];
+}
+
+/* Riserva n frame fisici contigui oltre lo Swap Pool e ne ritorna
+ * l'indirizzo. I frame sono assegnati una sola volta, durante
+ * l'inizializzazione del Support Level (test), e mai restituiti: non serve
+ * quindi mutua esclusione. Esaurire la RAM è un errore di configurazione,
+ * così come chiamarla prima di initSwapStructs. */
+memaddr allocFrames(int n) {
+    memaddr ramtop;
+    RAMTOP(ramtop);
+
+    memaddr base = nextFreeFrame;
+    if (base == 0 || base + n * PAGESIZE > ramtop - KERNEL_TOP_FRAMES * PAGESIZE)
+        PANIC();
+    nextFreeFrame += n * PAGESIZE;
+    return base;
+}
+
+/* Chiamata a inizializzazione conclusa: le strutture del Support Level
+ * devono aver chiesto ad allocFrames esattamente i frame tolti allo Swap
+ * Pool. Una SUPPORT_RESERVED_FRAMES non aggiornata lascerebbe altrimenti
+ * frame inutilizzati, o li prenderebbe a uno Swap Pool già al massimo. */
+void checkReservedFrames(void) {
+    if (nextFreeFrame - reservedBase != SUPPORT_RESERVED_FRAMES * PAGESIZE)
+        PANIC();
+}
+
+static void raFeedback(int i, int used);
+
+/* Concorrenza sullo Swap Pool
+ *
+ * swapPoolSem protegge solo la Swap Pool table e le Page Table e non è mai
+ * tenuto durante un'operazione sul backing store: i page fault di U-proc
+ * diverse, con backing store su flash diversi, hanno così l'I/O in corso
+ * contemporaneamente. Un frame con I/O in corso è marcato sw_busy: non può
+ * essere scelto come vittima né liberato, e mantiene la pagina che sta
+ * scrivendo o leggendo, così chi la cerca attende (con una YIELD, come in
+ * bufCache.c) invece di rileggere dal device una copia non aggiornata. */
+
+/* Rilascia swapPoolSem, cede la CPU e lo riacquisisce: attesa che l'I/O
+ * in corso su un frame busy si concluda. */
+static void yieldSwapPool(void) {
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    SYSCALL(YIELD, 0, 0, 0);
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+}
+
+/* Device flash dell'immagine del programma di una U-proc: vi si leggono
+ * le pagine di .text condivise, ed è la chiave con cui queste sono cercate
+ * nella Swap Pool table. */
+static inline int backingDev(support_t *sup) {
+    return sup->sup_imgDev;
+}
+
+/* TRUE se il frame i è mappato da più U-proc: .text condiviso o pagina
+ * privata ancora in comune tra padre e figli dopo una fork. */
+static inline int multiOwner(int i) {
+    return swapPool[i].sw_asid == SWAP_FRAME_SHARED ||
+           swapPool[i].sw_asid == SWAP_FRAME_COW;
+}
+
+/* TRUE se la pagina p della U-proc sup è in un frame con I/O in corso:
+ * privata, .text condiviso dello stesso programma o COW in uscita. */
+static int pageInTransit(support_t *sup, int p) {
+    for (int i = 0; i < swapPoolSize; i++) {
+        swap_t *f = &swapPool[i];
+        if (!f->sw_busy || f->sw_pageNo != p)
+            continue;
+        if (f->sw_asid == sup->sup_asid ||
+            (f->sw_asid == SWAP_FRAME_SHARED && f->sw_dev == backingDev(sup)) ||
+            (f->sw_asid == SWAP_FRAME_COW &&
+             (f->sw_owners & ASIDBIT(sup->sup_asid))))
+            return 1;
+    }
+    return 0;
+}
+
+/* TRUE se il frame i ha I/O in corso su una pagina privata della U-proc
+ * asid, o su una pagina COW da scrivere anche sul suo backing store. */
+static int frameBusyFor(int i, int asid) {
+    return swapPool[i].sw_busy &&
+           (swapPool[i].sw_asid == asid ||
+            (swapPool[i].sw_asid == SWAP_FRAME_COW &&
+             (swapPool[i].sw_owners & ASIDBIT(asid))));
+}
+
+/* Insieme residente
+ *
+ * Ogni frame occupato è in una lista tramite sw_link: quella sup_resident
+ * della U-proc proprietaria se privato, sharedFrames se mappato da più
+ * U-proc. sup_rss conta i frame privati di una U-proc; la terminazione
+ * (releaseAsidFrames) scorre solo le due liste invece dell'intera Swap
+ * Pool table. */
+
+/* Cambia il proprietario del frame i in asid (un ASID, SWAP_FRAME_SHARED,
+ * SWAP_FRAME_COW o SWAP_FRAME_FREE), spostandolo nella lista giusta. */
+static void setFrameAsid(int i, int asid) {
+    swap_t *f = &swapPool[i];
+
+    if (!list_empty(&f->sw_link)) {
+        list_del(&f->sw_link);
+        if (f->sw_asid > 0)
+            getSupport(f->sw_asid)->sup_rss--;
+    }
+    f->sw_asid = asid;
+    if (asid > 0) {
+        list_add_tail(&f->sw_link, &getSupport(asid)->sup_resident);
+        getSupport(asid)->sup_rss++;
+    } else if (asid != SWAP_FRAME_FREE) {
+        list_add_tail(&f->sw_link, &sharedFrames);
+    }
+}
+
+/* Indice nello Swap Pool del frame con il link pos. */
+static inline int listFrame(struct list_head *pos) {
+    return (int)(container_of(pos, swap_t, sw_link) - swapPool);
+}
+
+/* Frame residenti privati della U-proc asid. */
+int residentSetSize(int asid) {
+    return getSupport(asid)->sup_rss;
+}
+
+/* Pagine condivise */
+
+/* PTE della U-proc asid che mappa il frame condiviso (o COW) i, NULL se
+ * nessuna. */
+static pteEntry_t *sharedMapping(int i, int asid) {
+    pteEntry_t *pte = pageTableEntry(getSupport(asid), swapPool[i].sw_pageNo, 0);
+    if (pte != NULL && (pte->pte_entryLO & VALIDON) &&
+        (pte->pte_entryLO & ENTRYLO_PFN_MASK) == frameAddr(i))
+        return pte;
+    return NULL;
+}
+
+/* TRUE se la pagina del frame occupato i è stata riferita (da una
+ * qualsiasi U-proc, se condivisa). Con clear spegne i bit accesi e toglie
+ * le relative entry dal TLB. */
+static int frameReferenced(int i, int clear) {
+    int ref = 0;
+    for (int asid = 1; asid <= UPROCMAX; asid++) {
+        pteEntry_t *pte;
+        if (multiOwner(i))
+            pte = sharedMapping(i, asid);
+        else
+            pte = (asid == swapPool[i].sw_asid) ? swapPool[i].sw_pte : NULL;
+        if (pte == NULL || !(pte->pte_entryLO & PTE_REFERENCED))
+            continue;
+        ref = 1;
+        if (clear) {
+            interruptsOff();
+            pte->pte_entryLO &= ~PTE_REFERENCED;
+            tlbInvalidate(pte);
+            interruptsOn();
+        }
+    }
+    return ref;
+}
+
+/* Invalida in Page Table e TLB tutte le mappature del frame occupato i.
+ * Per un frame COW ricorda in sw_owners chi lo mappava: la pagina va
+ * scritta sul backing store di ciascuno (pageOut) e torna privata. */
+static void unmapFrame(int i) {
+    if (!multiOwner(i)) {
+        markPageNotValid(swapPool[i].sw_pte);
+        return;
+    }
+    swapPool[i].sw_owners = 0;
+    for (int asid = 1; asid <= UPROCMAX; asid++) {
+        pteEntry_t *pte = sharedMapping(i, asid);
+        if (pte == NULL)
+            continue;
+        markPageNotValid(pte);
+        if (swapPool[i].sw_asid == SWAP_FRAME_COW) {
+            pte->pte_entryLO &= ~(PTE_COW | PTE_ZEROFILL);
+            swapPool[i].sw_owners |= ASIDBIT(asid);
+        }
+    }
+    swapPool[i].sw_refs = 0;
+}
+
+/* Frame (non busy) che contiene già il blocco p del device dev come pagina
+ * condivisa, -1 se non c'è. */
+static int lookupShared(int dev, int p) {
+    for (int i = 0; i < swapPoolSize; i++)
+        if (swapPool[i].sw_asid == SWAP_FRAME_SHARED && !swapPool[i].sw_busy &&
+            swapPool[i].sw_dev == dev && swapPool[i].sw_pageNo == p)
+            return i;
+    return -1;
+}
+
+/* Aggiorna il massimo di frame con I/O contemporaneamente in corso:
+ * misura quanto i page fault si sovrappongono davvero. */
+static void noteInFlight(void) {
+    unsigned int n = 0;
+    for (int i = 0; i < swapPoolSize; i++)
+        if (swapPool[i].sw_busy)
+            n++;
+    if (n > vmStats.vs_maxInFlight)
+        vmStats.vs_maxInFlight = n;
+}
+
+/* Quote di frame (Page-Fault Frequency)
+ *
+ * Ogni U-proc ha una quota di frame privati (sup_quota), adattata alla
+ * frequenza dei suoi page fault: contati in finestre di PFF_WINDOW_US, la
+ * quota cresce di PFF_STEP se in una finestra i fault sono almeno
+ * PFF_HIGH e cala di PFF_STEP se non superano PFF_LOW. Il rimpiazzo
+ * sceglie la vittima prima tra i frame della U-proc più oltre la propria
+ * quota (quotaVictim): una U-proc con un working set grande si ruba i
+ * frame da sola invece di sfrattare le pagine calde delle altre. */
+
+/* Quota iniziale di una U-proc: una parte uguale dello Swap Pool. Vale
+ * anche come inizializzazione dello stato per il controllo del carico. */
+static void initQuota(support_t *sup) {
+    sup->sup_suspend   = LC_RUNNING;
+    sup->sup_resumeSem = 0;
+    sup->sup_launchSeq = ++launchSeq;
+    sup->sup_quota     = swapPoolSize / UPROCMAX;
+    if (sup->sup_quota < WS_QUOTA_MIN)
+        sup->sup_quota = WS_QUOTA_MIN;
+    sup->sup_pffFaults = 0;
+    STCK(sup->sup_pffStart);
+}
+
+/* Chiude la finestra di conteggio dei fault di sup se è trascorsa
+ * (swapPoolSem acquisito) e aggiorna la quota. Più finestre senza alcun
+ * fault contano come una sola finestra quieta. */
+static void pffSample(support_t *sup) {
+    cpu_t now;
+    STCK(now);
+
+    unsigned int us = (unsigned int)(now - sup->sup_pffStart) /
+                      *((unsigned int *) TIMESCALEADDR);
+    if (us < PFF_WINDOW_US)
+        return;
+    if (sup->sup_pffFaults >= PFF_HIGH && sup->sup_quota < swapPoolSize) {
+        sup->sup_quota += PFF_STEP;
+        if (sup->sup_quota > swapPoolSize)
+            sup->sup_quota = swapPoolSize;
+        vmStats.vs_quotaGrows++;
+    } else if (sup->sup_pffFaults <= PFF_LOW && sup->sup_quota > WS_QUOTA_MIN) {
+        sup->sup_quota -= PFF_STEP;
+        if (sup->sup_quota < WS_QUOTA_MIN)
+            sup->sup_quota = WS_QUOTA_MIN;
+        vmStats.vs_quotaShrinks++;
+    }
+    sup->sup_pffFaults = 0;
+    sup->sup_pffStart  = now;
+}
+
+/* Aggiorna le quote delle U-proc che non hanno fault da tempo (chiamata
+ * dal daemon di page-out): altrimenti la quota di una U-proc quieta non
+ * calerebbe mai. */
+static void pffAge(void) {
+    for (int asid = 1; asid <= UPROCMAX; asid++)
+        if (getSupport(asid)->sup_quota > 0)
+            pffSample(getSupport(asid));
+}
+
+/* Vittima tra i frame privati della U-proc più oltre la propria quota, -1
+ * se nessuna la supera (o le quote sono disattivate). La lista
+ * sup_resident fa da coda: con Clock un frame riferito perde il bit e va
+ * in fondo (seconda chance), con FIFO si prende il più vecchio non busy. */
+static int quotaVictim(void) {
+    support_t *over   = NULL;
+    int        excess = 0;
+
+    if (!wsQuotas)
+        return -1;
+    for (int asid = 1; asid <= UPROCMAX; asid++) {
+        support_t *sup = getSupport(asid);
+        if (sup->sup_quota > 0 && sup->sup_rss - sup->sup_quota > excess) {
+            over   = sup;
+            excess = sup->sup_rss - sup->sup_quota;
+        }
+    }
+    if (over == NULL)
+        return -1;
+
+    int victim = -1;
+    for (int n = 0; n < 2 * over->sup_rss; n++) {
+        struct list_head *pos = over->sup_resident.next;
+        int               i   = listFrame(pos);
+
+        list_del(pos);
+        list_add_tail(pos, &over->sup_resident);
+        if (swapPool[i].sw_busy)
+            continue;
+        if (replacementPolicy == REPL_CLOCK && frameReferenced(i, 1)) {
+            raFeedback(i, 1);
+            vmStats.vs_refCleared++;
+            continue;
+        }
+        victim = i;
+        break;
+    }
+    if (victim >= 0)
+        vmStats.vs_quotaEvictions++;
+    return victim;
+}
+
+/* Rimpiazzo pagine */
+
+/* Sceglie il frame dello Swap Pool da assegnare alla pagina mancante
+ * (da chiamare con swapPoolSem acquisito). I frame busy sono saltati. Se
+ * una U-proc supera la propria quota la vittima è sua (quotaVictim),
+ * altrimenti:
+ *  - FIFO: round robin sui frame, senza guardare l'uso delle pagine.
+ *  - Clock: la lancetta salta i frame con PTE_REFERENCED acceso, dando
+ *    loro una seconda chance: azzera il bit e toglie la pagina dal TLB,
+ *    così il prossimo accesso passa dal TLB-Refill che riaccende il bit.
+ *    Un frame libero è scelto subito. Dopo al più un giro completo ogni
+ *    bit è spento: la scansione termina.
+ * Ritorna -1 se tutti i frame sono busy. */
+static int selectVictim(void) {
+    int q = quotaVictim();
+    if (q >= 0)
+        return q;
+
+    if (replacementPolicy == REPL_FIFO) {
+        for (int n = 0; n < swapPoolSize; n++) {
+            int i = fifoNext;
+            fifoNext = (fifoNext + 1) % swapPoolSize;
+            if (!swapPool[i].sw_busy)
+                return i;
+        }
+        return -1;
+    }
+
+    int victim = -1;
+    for (int n = 0; n < 2 * swapPoolSize; n++) {
+        int i = clockHand;
+        clockHand = (clockHand + 1) % swapPoolSize;
+
+        if (swapPool[i].sw_busy)
+            continue;
+        if (swapPool[i].sw_asid == SWAP_FRAME_FREE) {
+            victim = i;
+            break;
+        }
+        if (frameReferenced(i, 1)) {
+            raFeedback(i, 1);
+            vmStats.vs_refCleared++;
+            continue;
+        }
+        victim = i;
+        break;
+    }
+    return victim;
+}
+
+/* Primo frame libero dello Swap Pool, -1 se non ce ne sono. I frame
+ * recuperabili sono usati solo in mancanza d'altro, il più vecchio per
+ * primo: la loro pagina resta rimappabile il più a lungo possibile. */
+static int findFreeFrame(void) {
+    if (swapFreeCount == 0)
+        return -1;
+    for (int i = 0; i < swapPoolSize; i++)
+        if (swapPool[i].sw_asid == SWAP_FRAME_FREE && swapPool[i].sw_reclaim == 0)
+            return i;
+    return list_empty(&reclaimFrames) ? -1 : listFrame(reclaimFrames.next);
+}
+
+/* Fault minori
+ *
+ * Un frame sfrattato dal daemon di page-out o dalla sospensione torna
+ * libero ma conserva la pagina (già scritta sul backing store se sporca)
+ * finché non viene riassegnato. sw_reclaim ricorda di chi era: l'ASID
+ * della U-proc, o SWAP_FRAME_SHARED per il .text condiviso (con il flash
+ * in sw_dev). Un nuovo fault sulla stessa pagina rimappa il frame, senza
+ * I/O. Restano escluse le pagine COW, che al rilascio tornano private di
+ * più U-proc, e quelle delle regioni mappate, il cui numero di pagina può
+ * passare a un'altra regione. */
+
+/* TRUE se il frame recuperabile i contiene la pagina p della U-proc sup
+ * (o, per il .text condiviso, del suo programma). */
+static int reclaimMatch(int i, support_t *sup, int p) {
+    swap_t *f = &swapPool[i];
+    return f->sw_pageNo == p &&
+           (f->sw_reclaim == sup->sup_asid ||
+            (f->sw_reclaim == SWAP_FRAME_SHARED && f->sw_dev == backingDev(sup)));
+}
+
+/* Frame recuperabile con la pagina p della U-proc sup, -1 se non c'è. */
+static int findReclaimable(support_t *sup, int p) {
+    struct list_head *pos;
+    list_for_each(pos, &reclaimFrames) {
+        if (reclaimMatch(listFrame(pos), sup, p))
+            return listFrame(pos);
+    }
+    return -1;
+}
+
+/* Toglie dai recuperabili un'eventuale vecchia copia della pagina p di
+ * sup, che sta per essere caricata altrove: potrebbe diventare obsoleta. */
+static void forgetReclaimable(support_t *sup, int p) {
+    int j = findReclaimable(sup, p);
+    if (j >= 0) {
+        list_del(&swapPool[j].sw_link);
+        swapPool[j].sw_reclaim = 0;
+    }
+}
+
+/* Intesta il frame i alla pagina p della U-proc sup, marcandolo busy per
+ * la lettura che segue. Una pagina di .text condivisibile non appartiene a
+ * nessuna U-proc in particolare: è identificata dal blocco sul device. */
+static void setOwner(int i, support_t *sup, int p, int prefetched) {
+    pteEntry_t *pte = pageTableEntry(sup, p, 0);
+
+    swapPool[i].sw_reclaim = 0;
+    forgetReclaimable(sup, p);
+    if (pte->pte_entryLO & PTE_SHARED) {
+        setFrameAsid(i, SWAP_FRAME_SHARED);
+        swapPool[i].sw_pte = NULL;
+    } else {
+        setFrameAsid(i, sup->sup_asid);
+        swapPool[i].sw_pte = pte;
+    }
+    swapPool[i].sw_pageNo     = p;
+    swapPool[i].sw_dev        = (swapPool[i].sw_asid == SWAP_FRAME_SHARED)
+                                    ? backingDev(sup) : -1;
+    swapPool[i].sw_refs       = 1;
+    swapPool[i].sw_prefetched = prefetched ? sup->sup_asid : 0;
+    swapPool[i].sw_busy       = 1;
+}
+
+/* Assegna il frame libero i alla pagina p della U-proc sup. */
+static void assignFrame(int i, support_t *sup, int p, int prefetched) {
+    setOwner(i, sup, p, prefetched);
+    swapFreeCount--;
+}
+
+/* Marca libero il frame i. */
+static void releaseFrame(int i) {
+    setFrameAsid(i, SWAP_FRAME_FREE);
+    swapPool[i].sw_dev     = -1;
+    swapPool[i].sw_busy    = 0;
+    swapPool[i].sw_reclaim = 0;
+    swapFreeCount++;
+}
+
+/* Marca libero il frame i, appena sfrattato (e scritto se sporco), e lo
+ * mette tra i recuperabili: la sua pagina resta rimappabile finché il
+ * frame non viene riassegnato. */
+static void releaseReclaimable(int i) {
+    int owner = swapPool[i].sw_asid;
+    int dev   = swapPool[i].sw_dev;
+
+    releaseFrame(i);
+    if (!frameReclaim || owner == SWAP_FRAME_COW ||
+        swapPool[i].sw_pageNo >= UPROC_MMAPBASE)
+        return;
+    swapPool[i].sw_reclaim = owner;
+    swapPool[i].sw_dev     = dev;
+    list_add_tail(&swapPool[i].sw_link, &reclaimFrames);
+}
+
+/* Inizializzazione*/
+
+/* Frame occupati da una Swap Pool table di n entry. */
+static inline int tableFrames(int n) {
+    return (int)((n * sizeof(swap_t) + PAGESIZE - 1) / PAGESIZE);
+}
+
+/* Dimensiona lo Swap Pool sulla RAM della macchina: tutti i frame tra
+ * SWAP_POOL_START e gli stack del Nucleus in cima alla RAM, tolti quelli
+ * per la tabella stessa e per le altre strutture del Support Level
+ * (SUPPORT_RESERVED_FRAMES). Lo stesso kernel usa così tutta la memoria
+ * configurata (num-ram-frames) senza ricompilare. */
+static int swapPoolFrames(void) {
+    memaddr ramtop;
+    RAMTOP(ramtop);
+
+    int avail = (int)((ramtop - KERNEL_TOP_FRAMES * PAGESIZE - SWAP_POOL_START)
+                      / PAGESIZE) - SUPPORT_RESERVED_FRAMES;
+    int n = (avail < SWAP_POOL_MAX) ? avail : SWAP_POOL_MAX;
+    while (n > 0 && n + tableFrames(n) > avail)
+        n--;
+    if (n < SWAP_POOL_MIN)
+        PANIC();
+    return n;
+}
+
 void initSwapStructs(void) {
+    swapPoolSize  = swapPoolFrames();
+    nextFreeFrame = SWAP_POOL_START + swapPoolSize * PAGESIZE;
+    swapPool      = (swap_t *) allocFrames(tableFrames(swapPoolSize));
+    reservedBase  = nextFreeFrame;
+    forkFrame     = allocFrames(1);
+
+    /* I frame di allocFrames non sono azzerati: la RAM al boot non è
+     * garantita nulla. Le directory devono partire vuote anche per gli
+     * ASID mai usati, che le scansioni su 1..UPROCMAX (frameReferenced,
+     * sharedMapping, abortEvict) attraversano con pageTableEntry. */
+    memaddr tables = allocFrames(PGTBL_FRAMES);
+    for (int i = 0; i < PGTBL_FRAMES; i++) {
+        zeroPage(tables + i * PAGESIZE);
+        pgTblFree[i] = (pteEntry_t *)(tables + i * PAGESIZE);
+    }
+    pgTblFreeCount = PGTBL_FRAMES;
+
+    /* Directory delle Page Table: fuori dalla support_t, che altrimenti
+     * porterebbe PGDIR_ENTRIES puntatori nella memoria statica. */
+    memaddr dirs = allocFrames(PGDIR_FRAMES);
+    for (int i = 0; i < PGDIR_FRAMES; i++)
+        zeroPage(dirs + i * PAGESIZE);
+    for (int asid = 1; asid <= UPROCMAX; asid++)
+        getSupport(asid)->sup_pgDir =
+            (pteEntry_t **)(dirs + (asid - 1) * PGDIR_ENTRIES * WORDLEN);
+
     swapPoolSem = 1;
+    forkSem     = 1;
     fifoNext    = 0;
-    for (int i = 0; i < SWAP_POOL_SIZE; i++)
-        swapPool[i].sw_asid = SWAP_FRAME_FREE;
+    clockHand   = 0;
+    vmStats.vs_faults = vmStats.vs_minorFaults = vmStats.vs_evictions = 0;
+    vmStats.vs_pageOuts = vmStats.vs_refCleared = 0;
+    vmStats.vs_cleanEvictions = vmStats.vs_dirtied = 0;
+    vmStats.vs_readAhead = vmStats.vs_raHits = vmStats.vs_raWasted = 0;
+    vmStats.vs_syncEvictions = vmStats.vs_daemonEvictions = 0;
+    vmStats.vs_maxInFlight = 0;
+    vmStats.vs_tlbInvals = 0;
+    vmStats.vs_tlbSweeps = vmStats.vs_tlbBatched = vmStats.vs_tlbSkipped = 0;
+    tlbBatchMask = 0;
+    vmStats.vs_pageIns = vmStats.vs_zeroFills = 0;
+    vmStats.vs_sharedHits = 0;
+    vmStats.vs_forks = vmStats.vs_cowCopies = vmStats.vs_cowReuses = 0;
+    vmStats.vs_launches = vmStats.vs_prefaults = 0;
+    vmStats.vs_quotaGrows = vmStats.vs_quotaShrinks = 0;
+    vmStats.vs_quotaEvictions = 0;
+    vmStats.vs_suspends = vmStats.vs_suspended = vmStats.vs_resumes = 0;
+    launchSeq = 0;
+    for (int asid = 1; asid <= UPROCMAX; asid++)
+        getSupport(asid)->sup_quota = 0;
+    tlbRefills = refillCycles = 0;
+    vmStats.vs_uprocTime = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++)
+        vmStats.vs_latHist[i] = 0;
+    INIT_LIST_HEAD(&sharedFrames);
+    INIT_LIST_HEAD(&reclaimFrames);
+    for (int i = 0; i < swapPoolSize; i++) {
+        INIT_LIST_HEAD(&swapPool[i].sw_link);
+        swapPool[i].sw_asid       = SWAP_FRAME_FREE;
+        swapPool[i].sw_reclaim    = 0;
+        swapPool[i].sw_dev        = -1;
+        swapPool[i].sw_prefetched = 0;
+        swapPool[i].sw_busy       = 0;
+    }
+    for (int dev = 0; dev < DEVPERINT; dev++)
+        imgTextPages[dev] = imgZeroFrom[dev] = -1;
+    swapFreeCount = swapPoolSize;
+    pageoutSem    = 0;
+    pageoutIdle   = 0;
+}
+
+/* Layout dell'immagine: zero-fill on demand e .text condiviso */
+
+/* Marca le pagine non presenti della U-proc sup secondo il layout noto
+ * della sua immagine: PTE_SHARED quelle di solo .text, mappate in sola
+ * lettura e condivise tramite la Swap Pool table; PTE_ZEROFILL quelle
+ * oltre la parte del .data presente nel file (.bss e spazio non usato
+ * dall'immagine), che hanno contenuto iniziale nullo e al primo fault
+ * vengono azzerate in memoria invece di essere lette dal flash. */
+static void applyImage(support_t *sup) {
+    int dev = backingDev(sup);
+
+    sup->sup_zeroFrom = imgZeroFrom[dev];
+    for (int q = 0; q < UPROC_IMGPAGES; q++) {
+        pteEntry_t *pte = pageTableEntry(sup, q, 0);
+        if (pte == NULL || (pte->pte_entryLO & VALIDON))
+            continue;
+        if (q < imgTextPages[dev])
+            pte->pte_entryLO |= PTE_SHARED;
+        else if (q >= imgZeroFrom[dev])
+            pte->pte_entryLO |= PTE_ZEROFILL;
+    }
+}
+
+/* Appena caricata la pagina 0, che inizia con l'header aout del
+ * programma (frame hdr), ricava il layout dell'immagine: le pagine
+ * interamente prima del .data sono solo .text, quelle dopo la parte del
+ * .data presente nel file sono zero-fill. Una pagina a cavallo tra .text
+ * e .data o tra .data e .bss è privata e letta normalmente. Un header
+ * incoerente non abilita né condivisione né zero-fill. */
+static void learnImage(support_t *sup, memaddr hdr) {
+    unsigned int *aout      = (unsigned int *) hdr;
+    unsigned int  textEnd   = aout[AOUT_HE_TEXT_VADDR] + aout[AOUT_HE_TEXT_MEMSZ];
+    unsigned int  dataStart = aout[AOUT_HE_DATA_VADDR];
+    unsigned int  dataEnd   = dataStart + aout[AOUT_HE_DATA_FILESZ];
+    unsigned int  imgTop    = KUSEG + UPROC_IMGPAGES * PAGESIZE;
+    int           dev       = backingDev(sup);
+
+    imgTextPages[dev] = 0;
+    imgZeroFrom[dev]  = UPROC_IMGPAGES;
+    if (aout[AOUT_HE_TEXT_VADDR] != KUSEG || textEnd < KUSEG || textEnd > imgTop ||
+        dataStart < textEnd || dataEnd < dataStart || dataEnd > imgTop) {
+        applyImage(sup);
+        return;
+    }
+
+    imgTextPages[dev] = (int)((dataStart - KUSEG) / PAGESIZE);
+    imgZeroFrom[dev]  = (int)((dataEnd - KUSEG + PAGESIZE - 1) / PAGESIZE);
+    applyImage(sup);
 }
 
 void initUprocPageTable(support_t *sup) {
     int asid = sup->sup_asid;
-    for (int i = 0; i < UPROC_TEXTPAGES; i++) {
-        sup->sup_privatePgTbl[i].pte_entryHI =
-            ((KUSEG_VPN_START + i) << VPNSHIFT) | (asid << ASIDSHIFT);
-        sup->sup_privatePgTbl[i].pte_entryLO = DIRTYON; /* V=0: non presente */
+
+    /* Immagine del programma sul flash asid-1; le pagine sfrattate
+     * sporche vanno nell'area di swap (nessuno slot finché non accade). */
+    sup->sup_imgDev = asid - 1;
+
+    /* Nessuna tabella di secondo livello: sono create dal Pager al primo
+     * fault su ciascun blocco di pagine (vedi newPageTable), e le pagine di
+     * heap e stack partono zero-fill. Heap inizialmente vuoto. */
+    for (int d = 0; d < PGDIR_ENTRIES; d++)
+        sup->sup_pgDir[d] = NULL;
+    sup->sup_brk = HEAP_START;
+    for (int k = 0; k < MMAP_MAX; k++)
+        sup->sup_maps[k].mm_pages = 0;
+    INIT_LIST_HEAD(&sup->sup_resident);
+    sup->sup_rss = 0;
+    initQuota(sup);
+
+    /* Pagine di .text e .bss: si conoscono solo leggendo l'header aout,
+     * che arriva con la pagina 0 (vedi learnImage); dalla seconda
+     * esecuzione dello stesso programma il layout è già noto. */
+    sup->sup_zeroFrom = imgZeroFrom[backingDev(sup)];
+
+    /* Stato del read-ahead: nessun fault precedente, finestra iniziale. */
+    sup->sup_lastFault = -1;
+    sup->sup_raWindow  = RA_INIT;
+}
+
+/* Backing store (immagine, area di swap) e regioni mappate*/
+
+/* Regione mappata di sup che contiene la pagina p, NULL se nessuna. */
+static mmap_t *findMapping(support_t *sup, int p) {
+    for (int k = 0; k < MMAP_MAX; k++) {
+        mmap_t *m = &sup->sup_maps[k];
+        if (p >= m->mm_first && p < m->mm_first + m->mm_pages)
+            return m;
     }
-    /* Pagina di stack (indice 31). */
-    sup->sup_privatePgTbl[UPROC_STACKPAGE].pte_entryHI =
-        (KUSEG_STACK_VPN << VPNSHIFT) | (asid << ASIDSHIFT);
-    sup->sup_privatePgTbl[UPROC_STACKPAGE].pte_entryLO = DIRTYON;
+    return NULL;
 }
 
-/* Backing store (device flash)*/
+/* TRUE se la pagina p fa parte dello spazio logico di sup: immagine e
+ * stack sempre, lo heap fino al break, nella finestra delle regioni solo
+ * le pagine mappate. */
+static int legalPage(support_t *sup, int p) {
+    if (p < 0)
+        return 0;
+    if (p >= UPROC_MMAPBASE)
+        return findMapping(sup, p) != NULL;
+    if (p >= UPROC_HEAPBASE && p < UPROC_STACKBASE)
+        return HEAP_START + (p - UPROC_HEAPBASE) * PAGESIZE < sup->sup_brk;
+    return 1;
+}
 
-/* Esegue una operazione (FLASHREAD/FLASHWRITE) sul device flash della
- * U-proc identificata da asid, sul blocco blockNo, usando frameAddr come
- * sorgente/destinazione DMA. Ritorna lo status del device.*/
-int flashOperation(int asid, int blockNo, memaddr frameAddr_, int op) {
-    int        devNo = asid - 1;
-    dtpreg_t  *flash = (dtpreg_t *) DEV_REG_ADDR(IL_FLASH, devNo);
-    int        mutex = FLASH_MUTEX(devNo);
-    unsigned int status;
+/* Legge la pagina p della U-proc sup nel frame: una pagina di una regione
+ * mappata dal suo blocco sul device, una pagina già sfrattata sporca dalla
+ * cache compressa (senza I/O) o dal suo slot nell'area di swap, le altre
+ * (.text condiviso compreso) dall'immagine del programma, che non viene
+ * mai scritta. L'accesso passa
+ * per la cache dei blocchi: una pagina riletta di recente (es. rilancio
+ * dello stesso programma) è servita dalla RAM. Ritorna lo status del
+ * device. */
+static int pageRead(support_t *sup, int p, memaddr frame) {
+    if (p >= UPROC_MMAPBASE) {
+        mmap_t *m = findMapping(sup, p);
+        return bcacheRead(m->mm_line, m->mm_dev,
+                          m->mm_block + (p - m->mm_first), frame);
+    }
+    if (zcacheLoad(sup->sup_asid, p, frame))
+        return READY;
+    int slot = swapSlot(sup->sup_asid, p);
+    if (slot >= 0)
+        return bcacheRead(IL_DISK, VMDISK, slot, frame);
+    return bcacheRead(IL_FLASH, sup->sup_imgDev, p, frame);
+}
 
-    SYSCALL(PASSEREN, (int)&devMutex[mutex], 0, 0);
+/* Scrive il frame nella cache compressa o, se questa non lo accetta, nello
+ * slot dell'area di swap della pagina p di sup (assegnato da
+ * reserveSlots); sul device se p è in una regione mappata. Ritorna
+ * SWAP_FULL se la pagina non ha uno slot perché l'area è piena. */
+static int pageWrite(support_t *sup, int p, memaddr frame) {
+    if (p >= UPROC_MMAPBASE) {
+        mmap_t *m = findMapping(sup, p);
+        return bcacheWrite(m->mm_line, m->mm_dev,
+                           m->mm_block + (p - m->mm_first), frame);
+    }
+    if (zcacheStore(sup->sup_asid, p, frame))
+        return READY;
+    int slot = swapSlot(sup->sup_asid, p);
+    if (slot < 0)
+        return SWAP_FULL;
+    return bcacheWrite(IL_DISK, VMDISK, slot, frame);
+}
 
-    flash->data0 = frameAddr_;
-    /* numero blocco nei 3 byte alti, comando nel byte basso*/
-    unsigned int command = ((unsigned int)blockNo << 8) | op;
-    status = SYSCALL(DOIO, (int)&flash->command, (int)command, 0);
+/* Assegna uno slot nell'area di swap alla pagina del frame i, sfrattata
+ * sporca, per ogni U-proc su cui pageOut la scriverà (swapPoolSem
+ * acquisito: l'allocatore non ha un semaforo proprio). Le pagine delle
+ * regioni mappate vanno sul loro device e non hanno slot. */
+static void reserveSlots(int i) {
+    int p = swapPool[i].sw_pageNo;
 
-    SYSCALL(VERHOGEN, (int)&devMutex[mutex], 0, 0);
-    return (int)status;
+    if (p >= UPROC_MMAPBASE)
+        return;
+    if (swapPool[i].sw_asid != SWAP_FRAME_COW) {
+        allocSlot(swapPool[i].sw_asid, p);
+        return;
+    }
+    for (int asid = 1; asid <= UPROCMAX; asid++)
+        if (swapPool[i].sw_owners & ASIDBIT(asid))
+            allocSlot(asid, p);
+}
+
+/* Read-ahead */
+
+/* Aggiorna la finestra di read-ahead della U-proc proprietaria del frame i
+ * quando una pagina letta in anticipo lascia lo stato "prefetch": se nel
+ * frattempo è stata riferita (used) la finestra cresce fino a RA_MAX,
+ * altrimenti il read-ahead è stato inutile e la finestra si dimezza. */
+static void raFeedback(int i, int used) {
+    if (!swapPool[i].sw_prefetched)
+        return;
+    support_t *owner = getSupport(swapPool[i].sw_prefetched);
+    swapPool[i].sw_prefetched = 0;
+
+    if (used) {
+        vmStats.vs_raHits++;
+        if (owner->sup_raWindow < RA_MAX)
+            owner->sup_raWindow++;
+    } else {
+        vmStats.vs_raWasted++;
+        owner->sup_raWindow /= 2;
+        if (owner->sup_raWindow < RA_MIN)
+            owner->sup_raWindow = RA_MIN;
+    }
+}
+
+/* Rende presente una pagina letta in anticipo senza caricarla nel TLB:
+ * sarà il TLB-Refill a farlo (accendendo PTE_REFERENCED) al primo accesso. */
+static void markPageResident(pteEntry_t *pte, memaddr phys) {
+    interruptsOff();
+    pte->pte_entryLO = phys | VALIDON |
+                       (pte->pte_entryLO & (PTE_ZEROFILL | PTE_SHARED | PTE_COW));
+    interruptsOn();
+}
+
+/* Mappa in sola lettura nella pte il frame condiviso i, già in memoria:
+ * con tlb la traduzione è installata subito (fault), altrimenti al primo
+ * accesso (read-ahead). */
+static void mapShared(int i, pteEntry_t *pte, int tlb) {
+    swapPool[i].sw_refs++;
+    vmStats.vs_sharedHits++;
+    if (tlb)
+        markPagePresent(pte, frameAddr(i), 0);
+    else
+        markPageResident(pte, frameAddr(i));
+}
+
+/* TRUE se la pagina del frame occupato i va scritta sul backing store
+ * quando viene sfrattata. Una pagina COW lo è sempre: il backing store del
+ * figlio non ne ha ancora una copia. */
+static int frameDirty(int i) {
+    if (swapPool[i].sw_asid == SWAP_FRAME_COW)
+        return 1;
+    return swapPool[i].sw_asid != SWAP_FRAME_SHARED &&
+           (swapPool[i].sw_pte->pte_entryLO & DIRTYON);
+}
+
+/* Avvia lo sfratto della pagina che abita il frame occupato i
+ * (swapPoolSem acquisito): invalida PTE e TLB della vittima e marca il
+ * frame busy. Ritorna TRUE se la pagina è sporca e va scritta sul backing
+ * store con pageOut; una pagina pulita coincide già con la sua copia. */
+static int beginEvict(int i) {
+    pteEntry_t *victimPte   = swapPool[i].sw_pte;
+    int         victimDirty = frameDirty(i);
+
+    vmStats.vs_evictions++;
+    raFeedback(i, frameReferenced(i, 0));
+
+    /* Aggiorna Page Table + TLB della vittima (di tutte le U-proc che la
+     * condividono) in modo atomico. Una pagina zero-fill scritta sul
+     * backing store da qui in poi va riletta. */
+    unmapFrame(i);
+    if (victimDirty && victimPte != NULL)
+        victimPte->pte_entryLO &= ~PTE_ZEROFILL;
+    if (victimDirty)
+        reserveSlots(i);
+    swapPool[i].sw_busy = 1;
+
+    if (victimDirty)
+        vmStats.vs_pageOuts++;
+    else
+        vmStats.vs_cleanEvictions++;
+    return victimDirty;
+}
+
+/* Annulla lo sfratto del frame busy i la cui pagina non è stata scritta
+ * sul backing store (swapPoolSem acquisito): la pagina torna residente e
+ * sporca per chi la mappava, e sarà riscritta a uno sfratto successivo.
+ * Un frame COW torna in sola lettura a tutti i suoi proprietari, che non
+ * possono essere terminati finché il frame è busy. */
+static void abortEvict(int i) {
+    int p = swapPool[i].sw_pageNo;
+
+    interruptsOff();
+    if (swapPool[i].sw_asid == SWAP_FRAME_COW) {
+        for (int asid = 1; asid <= UPROCMAX; asid++) {
+            if (!(swapPool[i].sw_owners & ASIDBIT(asid)))
+                continue;
+            pteEntry_t *pte = pageTableEntry(getSupport(asid), p, 0);
+            pte->pte_entryLO = frameAddr(i) | VALIDON | PTE_COW |
+                               (pte->pte_entryLO & PTE_SHARED);
+            swapPool[i].sw_refs++;
+        }
+    } else {
+        pteEntry_t *pte = swapPool[i].sw_pte;
+        pte->pte_entryLO = frameAddr(i) | VALIDON | DIRTYON |
+                           (pte->pte_entryLO & PTE_SHARED);
+    }
+    interruptsOn();
+    swapPool[i].sw_busy = 0;
+}
+
+/* Scrive sul backing store la pagina del frame busy i (swapPoolSem NON
+ * acquisito: i campi di un frame busy non cambiano). Solo per frame
+ * privati o COW, questi sul backing store di ogni U-proc che li mappava:
+ * una pagina di .text condivisa non è mai sporca. Ritorna lo status. */
+static int pageOut(int i) {
+    int p = swapPool[i].sw_pageNo;
+
+    if (swapPool[i].sw_asid != SWAP_FRAME_COW)
+        return pageWrite(getSupport(swapPool[i].sw_asid), p, frameAddr(i));
+
+    int st = READY;
+    for (int asid = 1; asid <= UPROCMAX && st == READY; asid++)
+        if (swapPool[i].sw_owners & ASIDBIT(asid))
+            st = pageWrite(getSupport(asid), p, frameAddr(i));
+    return st;
+}
+
+/* Read-ahead sequenziale (swapPoolSem acquisito, rilasciato durante le
+ * letture): dopo il fault sulla pagina p, porta in memoria anche le pagine
+ * p+1..p+N non ancora presenti del .text/.data o della stessa regione
+ * mappata, con N = sup_raWindow. Le pagine sono rese presenti
+ * senza caricarle nel TLB e marcate "prefetch" nella Swap Pool table per
+ * misurarne l'utilità (raFeedback). Il read-ahead si ferma al primo frame
+ * vittima sporco, per non pagare una scrittura su una pagina ipotetica, e
+ * al primo errore di lettura (es. fine del device). Ritorna l'ultima
+ * pagina portata in memoria. */
+static int readAhead(support_t *sup, int p) {
+    int last = p;
+    int end  = UPROC_IMGPAGES;
+
+    if (p >= UPROC_MMAPBASE) {
+        mmap_t *m = findMapping(sup, p);
+        end = m->mm_first + m->mm_pages;
+    }
+    for (int k = 1; k <= sup->sup_raWindow; k++) {
+        int q = p + k;
+        if (q >= end)
+            break;
+        pteEntry_t *pte = pageTableEntry(sup, q, 1);
+        if (pte == NULL)
+            break;
+        if (pte->pte_entryLO & (VALIDON | PTE_ZEROFILL))
+            continue;
+        if (pte->pte_entryLO & PTE_SHARED) {
+            int j = lookupShared(backingDev(sup), q);
+            if (j >= 0) {
+                mapShared(j, pte, 0);
+                continue;
+            }
+        }
+        if (pageInTransit(sup, q))
+            continue;
+
+        /* Con una finestra ampia la lancetta può compiere un giro intero:
+         * non si sacrificano né la pagina appena caricata né quelle lette
+         * in anticipo in questo stesso passo. */
+        int i = findFreeFrame();
+        if (i < 0 && (i = selectVictim()) < 0)
+            break;
+        if (swapPool[i].sw_asid == SWAP_FRAME_FREE) {
+            assignFrame(i, sup, q, 1);
+        } else {
+            if (frameDirty(i) ||
+                (pageTableEntry(sup, p, 0)->pte_entryLO & ENTRYLO_PFN_MASK) ==
+                    frameAddr(i) ||
+                swapPool[i].sw_prefetched)
+                break;
+            beginEvict(i);
+            setOwner(i, sup, q, 1);
+        }
+
+        /* Lettura fuori dalla sezione critica. */
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        int st = pageRead(sup, q, frameAddr(i));
+        SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+        if (st != READY) {
+            releaseFrame(i);
+            break;
+        }
+
+        vmStats.vs_pageIns++;
+        swapPool[i].sw_busy = 0;
+        markPageResident(pte, frameAddr(i));
+        vmStats.vs_readAhead++;
+        last = q;
+    }
+    return last;
+}
+
+/* Daemon di page-out */
+
+/* Risveglia il daemon se i frame liberi sono scesi sotto la soglia bassa
+ * (swapPoolSem acquisito). */
+static void wakePageout(void) {
+    if (swapFreeCount < pageoutLow && pageoutIdle) {
+        pageoutIdle = 0;
+        SYSCALL(VERHOGEN, (int)&pageoutSem, 0, 0);
+    }
+}
+
+/* Corpo del daemon: sfratta una pagina per volta finché i frame liberi
+ * non raggiungono pageoutHigh, poi torna in attesa. Le vittime sporche
+ * sono scritte sul backing store qui, senza tenere swapPoolSem e fuori dal
+ * percorso del page fault, che così si riduce a una sola lettura in un
+ * frame libero. Se la scrittura fallisce (es. area di swap piena) la
+ * pagina resta residente e sporca, e il daemon torna in attesa invece di
+ * riprovare subito. */
+static void pageoutDaemon(void) {
+    while (1) {
+        SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+        while (swapFreeCount >= pageoutHigh) {
+            pageoutIdle = 1;
+            SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+            SYSCALL(PASSEREN, (int)&pageoutSem, 0, 0);
+            SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+        }
+        pffAge();
+        int i = selectVictim();
+        if (i < 0) {
+            /* Tutti i frame hanno I/O in corso. */
+            SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+            SYSCALL(YIELD, 0, 0, 0);
+            continue;
+        }
+        if (swapPool[i].sw_asid == SWAP_FRAME_FREE) {
+            SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+            continue;
+        }
+
+        vmStats.vs_daemonEvictions++;
+        int dirty = beginEvict(i);
+        int st    = READY;
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        if (dirty)
+            st = pageOut(i);
+        SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+        if (st != READY) {
+            abortEvict(i);
+            pageoutIdle = 1;
+            SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+            SYSCALL(PASSEREN, (int)&pageoutSem, 0, 0);
+            continue;
+        }
+        releaseReclaimable(i);
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    }
+}
+
+/* Avvia il daemon di page-out come figlio di test (kernel-mode, stack in
+ * un frame dedicato): viene terminato con test allo spegnimento. */
+void initPageoutDaemon(void) {
+    state_t s;
+    for (unsigned int i = 0; i < (STATE_T_SIZE_IN_BYTES / WORDLEN); i++)
+        ((unsigned int *)&s)[i] = 0;
+
+    s.pc_epc = (memaddr) pageoutDaemon;
+    s.reg_sp = allocFrames(1) + PAGESIZE;
+    s.status = SUPPORT_STATUS;
+    s.mie    = MIE_ALL;
+    SYSCALL(CREATEPROCESS, (int)&s, PROCESS_PRIO_LOW, 0);
+}
+
+/* Controllo del carico
+ *
+ * Quando troppe U-proc si contendono lo Swap Pool nessuna avanza: il
+ * sistema passa il tempo nel Pager e in coda ai device. Il daemon
+ * loadControlDaemon campiona a ogni tick dello pseudo-clock (100 ms) i
+ * page fault del sistema e le richieste in coda sui mutex di disk e flash;
+ * oltre le soglie chiede la sospensione della U-proc avviata più di
+ * recente, sotto LC_FAULTS_LOW la riprende. Una sola decisione per tick.
+ * La sospensione avviene nel Pager della U-proc stessa (suspendSelf), al
+ * suo prossimo page fault: lì non tiene swapPoolSem e i suoi frame privati
+ * possono essere liberati. */
+
+/* Richieste di I/O in coda (oltre a quella in corso) sui device a
+ * blocchi: i processi bloccati sui mutex di disk e flash. */
+static int ioQueueDepth(void) {
+    int n = 0;
+    for (int dev = 0; dev < DEVPERINT; dev++) {
+        if (devMutex[DISK_MUTEX(dev)] < 0)
+            n -= devMutex[DISK_MUTEX(dev)];
+        if (devMutex[FLASH_MUTEX(dev)] < 0)
+            n -= devMutex[FLASH_MUTEX(dev)];
+    }
+    return n;
+}
+
+/* Sfratta tutte le pagine private della U-proc sup, scrivendo quelle
+ * modificate, e la blocca fino alla ripresa (chiamata dal suo Pager, senza
+ * swapPoolSem). Se una scrittura fallisce la pagina resta residente
+ * (abortEvict) e la sospensione è annullata: la U-proc riprende con le
+ * pagine non ancora sfrattate. */
+static void suspendSelf(support_t *sup) {
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+    if (sup->sup_suspend != LC_SUSPEND_REQ) {
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        return;
+    }
+    tlbBatchBegin(sup->sup_asid);
+    while (!list_empty(&sup->sup_resident)) {
+        int i = listFrame(sup->sup_resident.next);
+        if (swapPool[i].sw_busy) {
+            yieldSwapPool();
+            continue;
+        }
+        if (beginEvict(i)) {
+            SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+            int st = pageOut(i);
+            SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+            if (st != READY) {
+                abortEvict(i);
+                tlbBatchEnd(sup->sup_asid);
+                sup->sup_suspend = LC_RUNNING;
+                SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+                return;
+            }
+        }
+        releaseReclaimable(i);
+    }
+    tlbBatchEnd(sup->sup_asid);
+    sup->sup_suspend   = LC_SUSPENDED;
+    sup->sup_pffFaults = 0;
+    vmStats.vs_suspended++;
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    SYSCALL(PASSEREN, (int)&sup->sup_resumeSem, 0, 0);
+}
+
+/* Riprende la U-proc sup, sospesa o in attesa di esserlo (swapPoolSem
+ * acquisito). */
+static void resumeUproc(support_t *sup) {
+    if (sup->sup_suspend == LC_SUSPENDED)
+        SYSCALL(VERHOGEN, (int)&sup->sup_resumeSem, 0, 0);
+    sup->sup_suspend = LC_RUNNING;
+    vmStats.vs_resumes++;
+}
+
+/* Una decisione del controllo del carico (swapPoolSem acquisito), dati i
+ * page fault dell'ultimo tick e la coda di I/O. Candidata alla sospensione
+ * è la U-proc più recente con frame privati, mai la shell (ASID 1) né
+ * l'ultima U-proc non sospesa; alla ripresa la più vecchia. Se il
+ * controllo è disattivato, o non resta nessuna U-proc attiva oltre alla
+ * shell, le sospese sono riprese comunque. */
+static void loadDecide(unsigned int faults, int ioq) {
+    support_t *newest = NULL, *oldest = NULL;
+    int        running = 0;
+
+    for (int asid = 2; asid <= UPROCMAX; asid++) {
+        support_t *sup = getSupport(asid);
+        if (!asidActive(asid))
+            continue;
+        if (sup->sup_suspend == LC_RUNNING) {
+            running++;
+            if (sup->sup_rss > 0 &&
+                (newest == NULL || sup->sup_launchSeq > newest->sup_launchSeq))
+                newest = sup;
+        } else if (oldest == NULL || sup->sup_launchSeq < oldest->sup_launchSeq) {
+            oldest = sup;
+        }
+    }
+
+    int high = faults >= LC_FAULTS_HIGH || ioq >= LC_IOQ_HIGH;
+    int low  = faults <= LC_FAULTS_LOW && ioq < LC_IOQ_HIGH;
+    if (oldest != NULL && (!loadControl || running == 0 || low))
+        resumeUproc(oldest);
+    else if (loadControl && high && newest != NULL && running > 1) {
+        newest->sup_suspend = LC_SUSPEND_REQ;
+        vmStats.vs_suspends++;
+    }
+}
+
+/* Daemon del controllo del carico: un campione a ogni tick dello
+ * pseudo-clock. */
+static void loadControlDaemon(void) {
+    unsigned int lastFaults = 0;
+
+    while (1) {
+        SYSCALL(CLOCKWAIT, 0, 0, 0);
+        SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+        unsigned int faults = vmStats.vs_faults - lastFaults;
+        lastFaults = vmStats.vs_faults;
+        loadDecide(faults, ioQueueDepth());
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    }
+}
+
+/* Avvia il daemon del controllo del carico come figlio di test, come il
+ * daemon di page-out. */
+void initLoadControl(void) {
+    state_t s;
+    for (unsigned int i = 0; i < (STATE_T_SIZE_IN_BYTES / WORDLEN); i++)
+        ((unsigned int *)&s)[i] = 0;
+
+    s.pc_epc = (memaddr) loadControlDaemon;
+    s.reg_sp = allocFrames(1) + PAGESIZE;
+    s.status = SUPPORT_STATUS;
+    s.mie    = MIE_ALL;
+    SYSCALL(CREATEPROCESS, (int)&s, PROCESS_PRIO_LOW, 0);
+}
+
+/* Registra la latenza di un page fault nell'istogramma hist di vmStats
+ * (vs_latHist, o vs_zcLatHist per i fault serviti dalla cache compressa):
+ * il bucket b conta i fault durati meno di LAT_BASE_US << b microsecondi
+ * (l'ultimo raccoglie tutti i più lenti). */
+static void recordLatency(cpu_t start, unsigned int *hist) {
+    cpu_t now;
+    STCK(now);
+
+    unsigned int us    = (unsigned int)(now - start) / *((unsigned int *) TIMESCALEADDR);
+    unsigned int limit = LAT_BASE_US;
+    int b = 0;
+    while (b < LAT_BUCKETS - 1 && us >= limit) {
+        limit <<= 1;
+        b++;
+    }
+    hist[b]++;
 }
 
 /*Pager*/
 
+/* Procura un frame per la pagina p della U-proc sup (swapPoolSem
+ * acquisito): di norma uno libero, tenuto in riserva dal daemon di
+ * page-out; se la riserva è esaurita, sfratto sincrono di una vittima
+ * scelta con FIFO o Clock (vedi selectVictim), scritta sul backing store
+ * senza tenere swapPoolSem. Se tutti i frame hanno I/O in corso si attende
+ * che uno si liberi. Ritorna il frame, busy e intestato alla pagina, o -1
+ * se la scrittura della vittima è fallita (la vittima resta allora
+ * residente e sporca). */
+static int takeFrame(support_t *sup, int p) {
+    int i;
+    int st = READY;
+    while ((i = findFreeFrame()) < 0 && (i = selectVictim()) < 0)
+        yieldSwapPool();
+
+    if (swapPool[i].sw_asid == SWAP_FRAME_FREE) {
+        assignFrame(i, sup, p, 0);
+        return i;
+    }
+    vmStats.vs_syncEvictions++;
+    if (beginEvict(i)) {
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        st = pageOut(i);
+        SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+    }
+    if (st != READY) {
+        abortEvict(i);
+        return -1;
+    }
+    /* Il frame passa direttamente alla pagina p, senza tornare libero. */
+    setOwner(i, sup, p, 0);
+    return i;
+}
+
+/* Prima scrittura della U-proc sup sulla pagina COW p (swapPoolSem
+ * acquisito). Se nessun altro mappa più il frame, questo torna privato
+ * senza copia; altrimenti la pagina è copiata in un frame nuovo, privato
+ * e sporco, e il frame comune perde un riferimento. Se durante la ricerca
+ * del frame la pagina è stata sfrattata, il fault si ripete e la pagina
+ * viene caricata dal backing store. Ritorna FALSE se la scrittura della
+ * vittima è fallita. */
+static int copyOnWrite(support_t *sup, pteEntry_t *pte, int p) {
+    int old = frameIndex(pte->pte_entryLO);
+
+    if (swapPool[old].sw_refs == 1) {
+        setFrameAsid(old, sup->sup_asid);
+        swapPool[old].sw_pte = pte;
+        pte->pte_entryLO &= ~PTE_COW;
+        markPageDirty(pte);
+        vmStats.vs_cowReuses++;
+        return 1;
+    }
+
+    int i = takeFrame(sup, p);
+    if (i < 0)
+        return 0;
+    if ((pte->pte_entryLO & (VALIDON | PTE_COW)) != (VALIDON | PTE_COW)) {
+        releaseFrame(i);
+        return 1;
+    }
+
+    old = frameIndex(pte->pte_entryLO);
+    copyPage(frameAddr(i), frameAddr(old));
+    if (--swapPool[old].sw_refs == 0)
+        releaseFrame(old);
+    swapPool[i].sw_busy = 0;
+    pte->pte_entryLO &= ~PTE_COW;
+    markPagePresent(pte, frameAddr(i), 1);
+    vmStats.vs_cowCopies++;
+    return 1;
+}
+
 void pager(void) {
     support_t *sup = (support_t *) SYSCALL(GETSUPPORTPTR, 0, 0, 0);
     state_t   *exState = &sup->sup_exceptState[PGFAULTEXCEPT];
 
     unsigned int excCode = exState->cause & CAUSE_EXCCODE_MASK;
 
-    /* TLB-Modification: una pagina marcata read-only è stata scritta.
-     * In PandOSsh non dovrebbe accadere: trattalo come program trap.*/
-    if (excCode == EXC_MOD) {
-        supTerminate(sup->sup_asid);
-        return;
-    }
+    /* Sospensione chiesta dal controllo del carico: i frame privati sono
+     * liberati e la U-proc attende la ripresa, poi il fault è servito. */
+    if (sup->sup_suspend == LC_SUSPEND_REQ)
+        suspendSelf(sup);
 
-    /* Mutua esclusione sullo Swap Pool.*/
+    cpu_t start;
+    STCK(start);
+
+    /* Mutua esclusione sullo Swap Pool (sezione critica breve: rilasciata
+     * durante l'I/O sul backing store).*/
     SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
 
-    /* Pagina mancante. */
-    int p = vpnToIndex(exState->entry_hi);
-    if (p < 0) {
-        /* Indirizzo fuori dallo spazio logico: program trap.*/
+    /* Indirizzo fuori dallo spazio logico, oltre la fine dello heap o in
+     * una parte non mappata della finestra delle regioni, o tabelle delle
+     * Page Table esaurite: program trap. */
+    int         p   = vpnToIndex(exState->entry_hi);
+    pteEntry_t *pte = NULL;
+    if (legalPage(sup, p))
+        pte = pageTableEntry(sup, p, 1);
+    if (pte == NULL) {
         SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
         supTerminate(sup->sup_asid);
         return;
     }
+    int shared = pte->pte_entryLO & PTE_SHARED;
 
-    /* Scelta del frame (FIFO). */
-    int i = fifoNext;
-    fifoNext = (fifoNext + 1) % SWAP_POOL_SIZE;
-    memaddr fa = frameAddr(i);
+    /* TLB-Modification: prima scrittura su una pagina caricata in sola
+     * lettura. La pagina diventa sporca e andrà riscritta sul backing store
+     * quando sarà sfrattata; se è ancora in comune con padre o figli (COW)
+     * viene prima copiata. Se nel frattempo è già stata sfrattata, la
+     * scrittura viene semplicemente ripetuta e genera un page fault. Il
+     * .text condiviso resta in sola lettura: scriverlo è un program trap. */
+    if (excCode == EXC_MOD) {
+        if (shared) {
+            SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+            supTerminate(sup->sup_asid);
+            return;
+        }
+        if ((pte->pte_entryLO & (VALIDON | PTE_COW)) == (VALIDON | PTE_COW)) {
+            if (!copyOnWrite(sup, pte, p)) {
+                SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+                supTerminate(sup->sup_asid);
+                return;
+            }
+        } else if (pte->pte_entryLO & VALIDON) {
+            markPageDirty(pte);
+            vmStats.vs_dirtied++;
+        }
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        LDST(exState);
+    }
 
-    /* Se il frame è occupato, sfratta la pagina che lo abita. */
-    if (swapPool[i].sw_asid != SWAP_FRAME_FREE) {
-        int        victimAsid = swapPool[i].sw_asid;
-        int        victimPage = swapPool[i].sw_pageNo;
-        pteEntry_t *victimPte  = swapPool[i].sw_pte;
+    /* Pagina in uscita (sfratto del daemon in corso) o, se condivisa, in
+     * caricamento da parte di un'altra U-proc: attende che l'I/O sia
+     * concluso prima di rileggerla. */
+    while (pageInTransit(sup, p))
+        yieldSwapPool();
 
-        /* Aggiorna Page Table + TLB della vittima in modo atomico. */
-        markPageNotValid(victimPte);
+    /* Pagina già presente (es. letta in anticipo mentre il TLB conteneva
+     * ancora la sua vecchia entry non valida): basta aggiornare il TLB. Una
+     * pagina COW resta in sola lettura fino al TLB-Modification. */
+    if (pte->pte_entryLO & VALIDON) {
+        markPagePresent(pte, pte->pte_entryLO & ENTRYLO_PFN_MASK,
+                        !shared && !(pte->pte_entryLO & PTE_COW) &&
+                        ((pte->pte_entryLO & DIRTYON) || isStoreFault(excCode)));
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        LDST(exState);
+    }
 
-        /* Scrive il contenuto del frame sul backing store della vittima. */
-        int st = flashOperation(victimAsid, victimPage, fa, FLASHWRITE);
-        if (st != READY) {
+    /* Pagina di .text già in memoria per un'altra istanza (o una
+     * precedente) dello stesso programma: basta mapparla. */
+    if (shared) {
+        int j = lookupShared(backingDev(sup), p);
+        if (j >= 0) {
+            mapShared(j, pte, 1);
             SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
-            supTerminate(sup->sup_asid);
-            return;
+            LDST(exState);
         }
     }
 
-    /* Legge la pagina p della U-proc corrente dal suo backing store.*/
-    int st = flashOperation(sup->sup_asid, p, fa, FLASHREAD);
+    /* Fault minore: la pagina è ancora nel frame da cui è stata sfrattata,
+     * non riassegnato. Basta rimapparlo, senza I/O. */
+    sup->sup_pffFaults++;
+    pffSample(sup);
+    int i = findReclaimable(sup, p);
+    if (i >= 0) {
+        assignFrame(i, sup, p, 0);
+        swapPool[i].sw_busy = 0;
+        markPagePresent(pte, frameAddr(i), !shared && isStoreFault(excCode));
+        vmStats.vs_minorFaults++;
+        wakePageout();
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        LDST(exState);
+    }
+
+    vmStats.vs_faults++;
+    i = takeFrame(sup, p);
+    if (i < 0) {
+        SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+        supTerminate(sup->sup_asid);
+        return;
+    }
+    noteInFlight();
+    memaddr fa = frameAddr(i);
+
+    /* Legge la pagina p della U-proc corrente dal suo backing store, o la
+     * azzera se il suo contenuto iniziale è nullo, fuori dalla sezione
+     * critica: il frame è busy e non può essere sottratto.*/
+    int st       = READY;
+    int zeroFill = pte->pte_entryLO & PTE_ZEROFILL;
+    unsigned int *hist = (!zeroFill && p < UPROC_MMAPBASE &&
+                          zcacheHas(sup->sup_asid, p)) ?
+                         vmStats.vs_zcLatHist : vmStats.vs_latHist;
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    if (zeroFill)
+        zeroPage(fa);
+    else
+        st = pageRead(sup, p, fa);
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
     if (st != READY) {
+        releaseFrame(i);
         SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
         supTerminate(sup->sup_asid);
         return;
     }
+    swapPool[i].sw_busy = 0;
+    if (zeroFill)
+        vmStats.vs_zeroFills++;
+    else
+        vmStats.vs_pageIns++;
 
-    /* Aggiorna la Swap Pool table per il frame i.*/
-    swapPool[i].sw_asid   = sup->sup_asid;
-    swapPool[i].sw_pageNo = p;
-    swapPool[i].sw_pte    = &sup->sup_privatePgTbl[p];
+    /* Primo caricamento della pagina 0: l'header aout dice quali pagine
+     * sono solo .text e dove inizia il .bss. */
+    if (p == 0 && sup->sup_zeroFrom < 0)
+        learnImage(sup, fa);
 
     /* Aggiorna Page Table + TLB della U-proc corrente (atomico).*/
-    markPagePresent(&sup->sup_privatePgTbl[p], fa);
+    markPagePresent(pte, fa, !shared && isStoreFault(excCode));
+
+    /* Fault sequenziali sul .text/.data o su una regione mappata (heap e
+     * stack non contano): legge in anticipo le pagine successive. */
+    if (p < UPROC_HEAPBASE || p >= UPROC_MMAPBASE) {
+        if (readAheadOn && p == sup->sup_lastFault + 1)
+            p = readAhead(sup, p);
+        sup->sup_lastFault = p;
+    }
+    wakePageout();
 
     /* Rilascia la mutua esclusione e riprende la U-proc.*/
     SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    recordLatency(start, hist);
     LDST(exState);
 }
+
+/* Prefault al lancio */
+
+/* Porta in memoria la pagina p della U-proc sup, appena lanciata e non
+ * ancora in esecuzione (swapPoolSem acquisito, rilasciato durante la
+ * lettura), rendendola presente senza caricarla nel TLB: il primo accesso
+ * passa solo dal TLB-Refill. Il frame è procurato come per un page fault
+ * (takeFrame). Ritorna il frame, -1 se la pagina non è stata caricata. */
+static int prefaultPage(support_t *sup, int p) {
+    pteEntry_t *pte = pageTableEntry(sup, p, 1);
+    if (pte == NULL || (pte->pte_entryLO & VALIDON))
+        return -1;
+    if (pte->pte_entryLO & PTE_SHARED) {
+        int j = lookupShared(backingDev(sup), p);
+        if (j >= 0) {
+            mapShared(j, pte, 0);
+            vmStats.vs_prefaults++;
+            return j;
+        }
+    }
+
+    int i = takeFrame(sup, p);
+    if (i < 0)
+        return -1;
+
+    int st       = READY;
+    int zeroFill = pte->pte_entryLO & PTE_ZEROFILL;
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    if (zeroFill)
+        zeroPage(frameAddr(i));
+    else
+        st = pageRead(sup, p, frameAddr(i));
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+    if (st != READY) {
+        releaseFrame(i);
+        return -1;
+    }
+    swapPool[i].sw_busy = 0;
+    if (zeroFill)
+        vmStats.vs_zeroFills++;
+    else
+        vmStats.vs_pageIns++;
+    markPageResident(pte, frameAddr(i));
+    vmStats.vs_prefaults++;
+    return i;
+}
+
+/* Carica in un solo passo, prima che la U-proc sup esegua la prima
+ * istruzione, le pagine che tocca comunque all'avvio: la pagina 0 (header
+ * aout e UPROCSTARTADDR), la prima pagina del .data, nota dall'header, e
+ * la pagina in cima allo stack. Senza, ognuna costerebbe un page fault.
+ * Con prefaultOnLaunch = 0 (il default) le pagine sono caricate dal
+ * Pager come le altre; vs_faults / vs_launches misura il guadagno. */
+void prefaultUproc(support_t *sup) {
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+    vmStats.vs_launches++;
+    if (prefaultOnLaunch) {
+        int i = prefaultPage(sup, 0);
+        if (i >= 0 && sup->sup_zeroFrom < 0)
+            learnImage(sup, frameAddr(i));
+
+        int data = imgTextPages[backingDev(sup)];
+        if (data > 0 && data < UPROC_IMGPAGES)
+            prefaultPage(sup, data);
+        prefaultPage(sup, UPROC_STACKBASE);
+        wakePageout();
+    }
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+}
+
+/* Fork */
+
+/* Duplica lo spazio di indirizzamento della U-proc parent nel figlio
+ * child (ASID già assegnato, non ancora avviato). Le pagine residenti non
+ * vengono copiate: il frame passa a SWAP_FRAME_COW ed è mappato in sola
+ * lettura (PTE_COW) da entrambi, fino alla prima scrittura (copyOnWrite).
+ * Il .text condiviso e le pagine zero-fill non residenti restano tali; le
+ * pagine non residenti che il padre ha nell'area di swap sono copiate in
+ * slot del figlio, le altre si leggono dall'immagine, comune a entrambi.
+ * Il padre è fermo nella SYSCALL: le sue pagine non residenti non
+ * cambiano durante la copia. Le regioni di device mappate dal padre non
+ * passano al figlio. Padre e figlio hanno tutte le tabelle di secondo
+ * livello delle loro regioni. Ritorna FALSE se mancano tabelle o slot o
+ * la copia fallisce (il figlio è allora già smontato). */
+int forkAddressSpace(support_t *parent, support_t *child) {
+    int          c = child->sup_asid;
+    unsigned int copy[(UPROC_PAGES + 31) / 32]; /* pagine da copiare */
+    int          ok = 1;
+
+    child->sup_imgDev    = parent->sup_imgDev;
+    child->sup_zeroFrom  = parent->sup_zeroFrom;
+    child->sup_brk       = parent->sup_brk;
+    child->sup_lastFault = -1;
+    child->sup_raWindow  = RA_INIT;
+    for (int d = 0; d < PGDIR_ENTRIES; d++)
+        child->sup_pgDir[d] = NULL;
+    for (int k = 0; k < MMAP_MAX; k++)
+        child->sup_maps[k].mm_pages = 0;
+    INIT_LIST_HEAD(&child->sup_resident);
+    child->sup_rss = 0;
+    initQuota(child);
+    for (int w = 0; w < (UPROC_PAGES + 31) / 32; w++)
+        copy[w] = 0;
+
+    SYSCALL(PASSEREN, (int)&forkSem, 0, 0);
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+
+    /* Una pagina del padre in uscita non ha ancora la copia aggiornata sul
+     * backing store: si attende che nessuna sia in transito, poi tutta la
+     * Page Table è duplicata senza rilasciare swapPoolSem. */
+    for (int i = 0; i < swapPoolSize; i++) {
+        if (frameBusyFor(i, parent->sup_asid)) {
+            yieldSwapPool();
+            i = -1;
+        }
+    }
+
+    for (int p = 0; p < UPROC_PAGES; p++) {
+        pteEntry_t *ppte = pageTableEntry(parent, p, 1);
+        pteEntry_t *cpte = pageTableEntry(child, p, 1);
+        if (ppte == NULL || cpte == NULL) {
+            ok = 0;
+            break;
+        }
+        unsigned int lo = ppte->pte_entryLO;
+
+        if (!(lo & VALIDON)) {
+            cpte->pte_entryLO = lo & (PTE_SHARED | PTE_ZEROFILL);
+            if (swapSlot(parent->sup_asid, p) >= 0 ||
+                zcacheHas(parent->sup_asid, p)) {
+                if (allocSlot(c, p) < 0) {
+                    ok = 0;
+                    break;
+                }
+                copy[p / 32] |= 1u << (p % 32);
+            }
+            continue;
+        }
+
+        int i = frameIndex(lo);
+        if (swapPool[i].sw_asid == SWAP_FRAME_SHARED) {
+            cpte->pte_entryLO = (lo & ENTRYLO_PFN_MASK) | VALIDON | PTE_SHARED;
+        } else {
+            if (swapPool[i].sw_asid != SWAP_FRAME_COW) {
+                setFrameAsid(i, SWAP_FRAME_COW);
+                swapPool[i].sw_pte  = NULL;
+                swapPool[i].sw_refs = 1;
+            }
+            /* Il padre perde il permesso di scrittura (D) anche nel TLB. */
+            interruptsOff();
+            ppte->pte_entryLO = (lo & ~DIRTYON) | PTE_COW;
+            tlbInvalidate(ppte);
+            interruptsOn();
+            cpte->pte_entryLO = (lo & ENTRYLO_PFN_MASK) | VALIDON | PTE_COW;
+        }
+        swapPool[i].sw_refs++;
+    }
+    vmStats.vs_forks++;
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+
+    for (int p = 0; p < UPROC_PAGES && ok; p++) {
+        if (copy[p / 32] & (1u << (p % 32)))
+            ok = pageRead(parent, p, forkFrame) == READY &&
+                 pageWrite(child, p, forkFrame) == READY;
+    }
+    SYSCALL(VERHOGEN, (int)&forkSem, 0, 0);
+
+    if (!ok)
+        releaseAsidFrames(c);
+    return ok;
+}
+
+/* Regioni di device mappate */
+
+/* Indirizzo logico della pagina di indice p della finestra delle regioni. */
+static inline memaddr mmapAddr(int p) {
+    return MMAP_START + (p - UPROC_MMAPBASE) * PAGESIZE;
+}
+
+/* Mappa count blocchi del device (line, devNo), a partire da blockNo, in
+ * pagine consecutive libere della finestra delle regioni di sup (prima
+ * posizione utile). Nessun blocco viene letto qui: le pagine sono caricate
+ * dal Pager al primo accesso. Ritorna l'indirizzo della regione, o -1 se
+ * non ci sono regioni o pagine libere. */
+int mapRegion(support_t *sup, int line, int devNo, int blockNo, int count) {
+    mmap_t *slot  = NULL;
+    int     first = UPROC_MMAPBASE;
+
+    for (int k = 0; k < MMAP_MAX; k++) {
+        mmap_t *m = &sup->sup_maps[k];
+        if (m->mm_pages == 0) {
+            if (slot == NULL)
+                slot = m;
+        } else if (m->mm_first < first + count &&
+                   first < m->mm_first + m->mm_pages) {
+            /* Sovrapposta: si riprova subito dopo questa regione. */
+            first = m->mm_first + m->mm_pages;
+            slot  = NULL;
+            k     = -1;
+        }
+    }
+    if (slot == NULL || count > UPROC_MMAPBASE + UPROC_MMAPPAGES - first)
+        return -1;
+
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+    slot->mm_line  = line;
+    slot->mm_dev   = devNo;
+    slot->mm_block = blockNo;
+    slot->mm_first = first;
+    slot->mm_pages = count;
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+    return (int)mmapAddr(first);
+}
+
+/* Smonta la regione m di sup: le sue pagine residenti sono sfrattate, e
+ * quelle modificate scritte sul device, come per un normale rimpiazzo.
+ * Ritorna READY se tutti i blocchi della regione sono sul device, o lo
+ * status del primo errore di scrittura: le pagine non scritte restano
+ * allora residenti e la regione resta montata. */
+static int unmapMapping(support_t *sup, mmap_t *m) {
+    int st = READY;
+
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+    for (int i = 0; i < swapPoolSize; i++) {
+        while (frameBusyFor(i, sup->sup_asid))
+            yieldSwapPool();
+        if (swapPool[i].sw_asid != sup->sup_asid ||
+            swapPool[i].sw_pageNo < m->mm_first ||
+            swapPool[i].sw_pageNo >= m->mm_first + m->mm_pages)
+            continue;
+        if (beginEvict(i)) {
+            SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+            int w = pageOut(i);
+            SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+            if (w != READY) {
+                abortEvict(i);
+                if (st == READY)
+                    st = w;
+                continue;
+            }
+        }
+        releaseFrame(i);
+    }
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+
+    /* pageOut arriva solo alla cache write-back: i blocchi della regione
+     * vanno portati sul device prima di dichiarare la regione smontata. */
+    if (st == READY)
+        st = bcacheFlushRange(m->mm_line, m->mm_dev, m->mm_block, m->mm_pages);
+    if (st == READY)
+        m->mm_pages = 0;
+    return st;
+}
+
+/* Smonta la regione di sup che inizia all'indirizzo addr. Ritorna 0, -1 se
+ * non c'è una regione a quell'indirizzo, o lo status cambiato di segno se
+ * la scrittura di una pagina è fallita. */
+int unmapRegion(support_t *sup, memaddr addr) {
+    for (int k = 0; k < MMAP_MAX; k++) {
+        mmap_t *m = &sup->sup_maps[k];
+        if (m->mm_pages > 0 && mmapAddr(m->mm_first) == addr) {
+            int st = unmapMapping(sup, m);
+            return (st == READY) ? 0 : -st;
+        }
+    }
+    return -1;
+}
+
+/* Smonta tutte le regioni di sup (terminazione): le pagine modificate
+ * arrivano sul device prima che i frame vengano liberati. Quelle la cui
+ * scrittura fallisce sono perse con gli altri frame della U-proc. */
+void unmapAllRegions(support_t *sup) {
+    for (int k = 0; k < MMAP_MAX; k++)
+        if (sup->sup_maps[k].mm_pages > 0)
+            unmapMapping(sup, &sup->sup_maps[k]);
+}
+
+/* Terminazione */
+
+/* Libera i frame dello Swap Pool occupati dalla U-proc asid, per evitare
+ * scritture spurie sul backing store in futuro, e toglie le sue pagine dal
+ * TLB: l'ASID sarà riusato da una nuova U-proc. Si scorrono solo la lista
+ * dei suoi frame privati e quella dei frame condivisi, non tutta la Swap
+ * Pool table. Un frame che il daemon sta ancora scrivendo (anche sul
+ * backing store di questa U-proc, se COW) viene liberato da lui: si
+ * attende che finisca. Le pagine di .text condivise vengono solo smappate:
+ * restano in memoria per le altre istanze e per le esecuzioni successive
+ * dello stesso programma, finché il rimpiazzo non sceglie il loro frame.
+ * Un frame COW passa a chi lo mappa ancora, e si libera quando non lo
+ * mappa più nessuno. */
+void releaseAsidFrames(int asid) {
+    support_t        *sup = getSupport(asid);
+    struct list_head *pos, *next;
+
+    SYSCALL(PASSEREN, (int)&swapPoolSem, 0, 0);
+    tlbBatchBegin(asid);
+    while (!list_empty(&sup->sup_resident)) {
+        int i = listFrame(sup->sup_resident.next);
+        if (swapPool[i].sw_busy) {
+            yieldSwapPool();
+            continue;
+        }
+        interruptsOff();
+        tlbInvalidate(swapPool[i].sw_pte);
+        interruptsOn();
+        releaseFrame(i);
+    }
+
+    for (pos = sharedFrames.next; pos != &sharedFrames; pos = next) {
+        int i = listFrame(pos);
+        next = pos->next;
+        if (frameBusyFor(i, asid)) {
+            yieldSwapPool();
+            next = sharedFrames.next;
+            continue;
+        }
+        pteEntry_t *pte = swapPool[i].sw_busy ? NULL : sharedMapping(i, asid);
+        if (pte == NULL)
+            continue;
+        markPageNotValid(pte);
+        if (--swapPool[i].sw_refs == 0 &&
+            swapPool[i].sw_asid == SWAP_FRAME_COW)
+            releaseFrame(i);
+    }
+    tlbBatchEnd(asid);
+    /* Le pagine recuperabili non devono passare al prossimo uso dell'ASID. */
+    for (pos = reclaimFrames.next; pos != &reclaimFrames; pos = next) {
+        next = pos->next;
+        if (swapPool[listFrame(pos)].sw_reclaim == asid) {
+            list_del(pos);
+            swapPool[listFrame(pos)].sw_reclaim = 0;
+        }
+    }
+    sup->sup_quota = 0;
+    zcacheFreeAsid(asid);
+    freeSlots(asid);
+    freePageTables(getSupport(asid));
+    SYSCALL(VERHOGEN, (int)&swapPoolSem, 0, 0);
+}
@@ -6,9 +6,22 @@
 #include <uriscv/liburiscv.h>
 
 #define TERMINATE      2
+#define WRITEPRINTER   3
 #define WRITETERMINAL  4
 #define READTERMINAL   5
 #define EXECUTE        6
+#define DISKPUT        7
+#define DISKGET        8
+#define FLASHPUT       9
+#define FLASHGET       10
+#define FORK           11
+#define SBRK           12
+#define DISKMAP        13
+#define FLASHMAP       14
+#define UNMAP          15
+
+/* Dimensione di un blocco di disk/flash (una pagina). */
+#define BLOCKSIZE      4096
 
 static int u_strlen(const char *s) {
     int n = 0;
@@ -21,6 +34,11 @@ static void u_print(const char *s) {
     SYSCALL(WRITETERMINAL, (unsigned int)s, u_strlen(s), 0);
 }
 
+/* Accoda una stringa sulla stampante della U-proc (SYS3). */
+static void u_printer(const char *s) {
+    SYSCALL(WRITEPRINTER, (unsigned int)s, u_strlen(s), 0);
+}
+
 /* Converte un intero (anche negativo) in stringa decimale. */
 static void u_itoa(int v, char *out) {
     char tmp[16];
@@ -50,6 +68,48 @@ static int u_execute(int asid) {
     return (int)SYSCALL(EXECUTE, (unsigned int)asid, 0, 0);
 }
 
+/* Crea una copia della U-proc corrente (SYS11): ritorna l'ASID del figlio
+ * al padre, 0 al figlio, -1 in caso di errore. */
+static int u_fork(void) {
+    return (int)SYSCALL(FORK, 0, 0, 0);
+}
+
+/* Estende lo heap di incr byte (SYS12): ritorna l'inizio della nuova area,
+ * o (void *)-1 se lo heap è esaurito. */
+static void *u_sbrk(int incr) {
+    return (void *)SYSCALL(SBRK, (unsigned int)incr, 0, 0);
+}
+
+/* I/O a blocchi (SYS7..SYS10): count blocchi consecutivi da/verso buf,
+ * che deve essere allineato alla word. Ritornano i blocchi trasferiti o
+ * un valore negativo (status del device) in caso di errore. */
+static int u_diskPut(void *buf, int dev, int sect, int count) {
+    return (int)SYSCALL(DISKPUT, (unsigned int)buf, (count << 8) | dev, sect);
+}
+static int u_diskGet(void *buf, int dev, int sect, int count) {
+    return (int)SYSCALL(DISKGET, (unsigned int)buf, (count << 8) | dev, sect);
+}
+static int u_flashPut(void *buf, int dev, int block, int count) {
+    return (int)SYSCALL(FLASHPUT, (unsigned int)buf, (count << 8) | dev, block);
+}
+static int u_flashGet(void *buf, int dev, int block, int count) {
+    return (int)SYSCALL(FLASHGET, (unsigned int)buf, (count << 8) | dev, block);
+}
+
+/* Regioni di device mappate (SYS13..SYS15): count blocchi consecutivi del
+ * device diventano pagine della U-proc, lette al primo accesso e riscritte
+ * sul device se modificate. u_diskMap/u_flashMap ritornano l'indirizzo
+ * della regione o (void *)-1; u_unmap ritorna 0 o un valore negativo. */
+static void *u_diskMap(int dev, int sect, int count) {
+    return (void *)SYSCALL(DISKMAP, (count << 8) | dev, sect, 0);
+}
+static void *u_flashMap(int dev, int block, int count) {
+    return (void *)SYSCALL(FLASHMAP, (count << 8) | dev, block, 0);
+}
+static int u_unmap(void *addr) {
+    return (int)SYSCALL(UNMAP, (unsigned int)addr, 0, 0);
+}
+
 /* Termina la U-proc corrente (SYS2). */
 static void u_terminate(void) {
     SYSCALL(TERMINATE, 0, 0, 0);